@@ -14,7 +14,7 @@
 //  and limitations under the License.
 
 #import <Cocoa/Cocoa.h>
-@class CouchDatabase, CouchPersistentReplication, DemoQuery, SyncpointClient;
+@class CouchDatabase, DemoQuery, SyncpointClient;
 
 
 /** Generic application delegate for simple Mac OS CouchDB demo apps.
@@ -37,7 +37,10 @@
     CouchDatabase* _database;
     DemoQuery* _query;
     BOOL _syncConfiguringDefault;
-    CouchPersistentReplication *_pull, *_push;
+    NSTimer* _syncTimer;
+    NSUInteger _syncErrorCount, _syncBaseline;
+    NSDate* _lastSyncError;
+    BOOL _syncing;
     BOOL _glowing;
 }
 
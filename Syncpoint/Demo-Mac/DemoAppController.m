@@ -18,6 +18,8 @@
 #import "MYURLHandler.h"
 #import "Test.h"
 #import "MYBlockUtils.h"
+#import "SyncpointBenchmark.h"
+#import "SyncpointTraceDecoder.h"
 #import <Syncpoint/Syncpoint.h>
 
 #undef FOR_TESTING_PURPOSES
@@ -36,9 +38,19 @@ static TDListener* sListener;
 
 #define kChangeGlowDuration 3.0
 
+#define kSyncPollInterval 1.0
+
 
 int main (int argc, const char * argv[]) {
     RunTestCases(argc,argv);
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--benchmark") == 0)
+            return RunSyncpointBenchmark();
+        if ((strcmp(argv[i], "--decode-trace") == 0 || strcmp(argv[i], "--chrome-trace") == 0)
+                && i + 1 < argc)
+            return RunSyncpointTraceDecoder([NSString stringWithUTF8String: argv[i+1]],
+                                            strcmp(argv[i], "--chrome-trace") == 0);
+    }
     return NSApplicationMain(argc, argv);
 }
 
@@ -144,72 +156,86 @@ int main (int argc, const char * argv[]) {
 #pragma mark - SYNC:
 
 
-- (void) observeReplication: (CouchPersistentReplication*)repl {
-    [repl addObserver: self forKeyPath: @"completed" options: 0 context: NULL];
-    [repl addObserver: self forKeyPath: @"total" options: 0 context: NULL];
-    [repl addObserver: self forKeyPath: @"error" options: 0 context: NULL];
-    [repl addObserver: self forKeyPath: @"mode" options: 0 context: NULL];
+/** The metrics of every replication Syncpoint is running: the control database's, and those of
+    each local channel installation. */
+- (NSArray*) allSyncMetrics {
+    NSMutableArray* allMetrics = [NSMutableArray arrayWithObject: _syncpoint.controlMetrics];
+    for (SyncpointInstallation* installation in _syncpoint.session.allInstallations) {
+        SyncpointSyncMetrics* metrics = [_syncpoint metricsForInstallation: installation];
+        if (metrics)
+            [allMetrics addObject: metrics];
+    }
+    return allMetrics;
 }
 
-- (void) stopObservingReplication: (CouchPersistentReplication*)repl {
-    [repl removeObserver: self forKeyPath: @"completed"];
-    [repl removeObserver: self forKeyPath: @"total"];
-    [repl removeObserver: self forKeyPath: @"error"];
-    [repl removeObserver: self forKeyPath: @"mode"];
-}
 
-- (void) forgetReplication: (CouchPersistentReplication**)repl {
-    if (*repl) {
-        [self stopObservingReplication: *repl];
-        [*repl release];
-        *repl = nil;
+- (void) observeSync {
+    if (!_syncTimer) {
+        _syncTimer = [[NSTimer scheduledTimerWithTimeInterval: kSyncPollInterval
+                                                       target: self
+                                                     selector: @selector(updateSyncStatus)
+                                                     userInfo: nil
+                                                      repeats: YES] retain];
     }
+    [self updateSyncStatus];
 }
 
 
-- (void) observeSync {
-    [self forgetReplication: &_pull];
-    [self forgetReplication: &_push];
-    
-    NSURL* otherDbURL = nil;
-    NSArray* repls = _database.replications;
-    if (repls.count >= 2) {
-        _pull = [[repls objectAtIndex: 0] retain];
-        _push = [[repls objectAtIndex: 1] retain];
-        [self observeReplication: _pull];
-        [self observeReplication: _push];
-        otherDbURL = _pull.remoteURL;
+- (void) updateSyncStatus {
+    NSArray* allMetrics = self.allSyncMetrics;
+    NSUInteger lag = 0, transferred = 0, errors = 0;
+    NSDate* lastSync = [NSDate distantFuture];
+    for (SyncpointSyncMetrics* metrics in allMetrics) {
+        lag += metrics.lag;
+        transferred += metrics.docsTransferred;
+        errors += metrics.errorCount;
+        NSDate* synced = metrics.lastSyncTime;
+        lastSync = synced ? [lastSync earlierDate: synced] : nil;
+    }
+
+    NSString* host = [NSURL URLWithString: kServerURLString].host;
+    _syncHostField.stringValue = allMetrics.count > 1 ? $sprintf(@"⇄ %@", host) : @"";
+
+    // Progress is measured from the point the replications last fell behind:
+    if (lag > 0 && !_syncing)
+        _syncBaseline = transferred;
+    _syncing = (lag > 0);
+    if (_syncing) {
+        NSUInteger completed = transferred - _syncBaseline;
+        NSLog(@"SYNC progress: %lu / %lu",
+              (unsigned long)completed, (unsigned long)(completed + lag));
+        [_syncProgress setDoubleValue: (completed / (double)(completed + lag))];
+    } else {
+        [_syncProgress setDoubleValue: 0.0];
     }
-    _syncHostField.stringValue = otherDbURL ? $sprintf(@"⇄ %@", otherDbURL.host) : @"";
-}
 
+    if (errors > _syncErrorCount) {
+        [_lastSyncError release];
+        _lastSyncError = [[NSDate date] retain];
+        NSAlert* alert = [NSAlert alertWithMessageText: @"Replication failed"
+                                         defaultButton: nil
+                                       alternateButton: nil
+                                           otherButton: nil
+                             informativeTextWithFormat: @"Replication with %@ failed.", host];
+        [alert beginSheetModalForWindow: _window
+                          modalDelegate: nil didEndSelector: NULL contextInfo: NULL];
+    }
+    _syncErrorCount = errors;
 
-- (void) updateSyncStatusView {
     int value;
-    NSString* tooltip = nil;
-    if (_pull.error) {
-        value = 3;  // red
-        tooltip = _pull.error.localizedDescription;
-    } else if (_push.error) {
+    NSString* tooltip;
+    if (_lastSyncError && (!lastSync || [lastSync compare: _lastSyncError] < 0)) {
         value = 3;  // red
-        tooltip = _push.error.localizedDescription;
-    } else switch(MAX(_pull.mode, _push.mode)) {
-        case kCouchReplicationStopped:
-            value = 3; 
-            tooltip = @"Sync stopped";
-            break;  // red
-        case kCouchReplicationOffline:
-            value = 2;  // yellow
-            tooltip = @"Offline";
-            break;
-        case kCouchReplicationIdle:
-            value = 0;
-            tooltip = @"Everything's in sync!";
-            break;
-        case kCouchReplicationActive:
-            value = 1;
-            tooltip = @"Syncing data...";
-            break;
+        tooltip = @"Sync failed";
+    } else if (_syncing) {
+        value = 1;
+        tooltip = @"Syncing data...";
+    } else if (lastSync) {
+        value = 0;
+        tooltip = @"Everything's in sync!";
+    } else {
+        value = 2;  // yellow
+        tooltip = @"Waiting to sync";
     }
     _syncStatusView.intValue = value;
     _syncStatusView.toolTip = tooltip;
@@ -234,40 +260,6 @@ int main (int argc, const char * argv[]) {
                 [self observeSync];
             }
         }
-        return;
-    }
-
-    CouchPersistentReplication* repl = object;
-    if ([keyPath isEqualToString: @"completed"] || [keyPath isEqualToString: @"total"]) {
-        if (repl == _pull || repl == _push) {
-            unsigned completed = _pull.completed + _push.completed;
-            unsigned total = _pull.total + _push.total;
-            NSLog(@"SYNC progress: %u / %u", completed, total);
-            if (total > 0 && completed < total) {
-                [_syncProgress setDoubleValue: (completed / (double)total)];
-            } else {
-                [_syncProgress setDoubleValue: 0.0];
-            }
-        }
-    } else if ([keyPath isEqualToString: @"mode"]) {
-        [self updateSyncStatusView];
-    } else if ([keyPath isEqualToString: @"error"]) {
-        [self updateSyncStatusView];
-        if (repl.error) {
-            NSAlert* alert = [NSAlert alertWithMessageText: @"Replication failed"
-                                             defaultButton: nil
-                                           alternateButton: nil
-                                               otherButton: nil
-                                 informativeTextWithFormat: @"Replication with %@ failed.\n\n %@",
-                              repl.remoteURL, repl.error.localizedDescription];
-            [alert beginSheetModalForWindow: _window
-                              modalDelegate: nil didEndSelector: NULL contextInfo: NULL];
-        }
-    } else if ([keyPath isEqualToString: @"running"]) {
-        if (repl != _push && repl != _pull) {
-            // end of a 1-shot replication
-            [self stopObservingReplication: repl];
-        }
     }
 }
 
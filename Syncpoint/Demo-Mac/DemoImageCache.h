@@ -0,0 +1,65 @@
+//
+//  DemoImageCache.h
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import <Cocoa/Cocoa.h>
+
+
+typedef void (^DemoImageCacheBlock)(NSImage* image);
+
+
+/** A memory-bounded cache of decoded images, keyed by attachment digest.
+    Images are fetched and decoded on a background queue, and can be stored either at full
+    resolution or as a downscaled thumbnail. When the total size of the decoded bitmaps exceeds
+    the byte budget, the least recently used images are evicted.
+    The cache should only be called on the main thread. */
+@interface DemoImageCache : NSObject
+{
+    NSMutableDictionary* _entries;
+    NSMutableArray* _lru;
+    NSMutableDictionary* _waiters;
+    NSUInteger _totalCost, _byteBudget;
+    CGFloat _thumbnailSize;
+    dispatch_queue_t _queue;
+}
+
++ (DemoImageCache*) sharedInstance;
+
+/** The maximum number of bytes of decoded bitmap data to keep. Defaults to 32MB. */
+@property NSUInteger byteBudget;
+
+/** The number of bytes of decoded bitmap data currently in the cache. */
+@property (readonly) NSUInteger totalCost;
+
+/** The maximum width or height, in pixels, of thumbnails. Defaults to 64. */
+@property CGFloat thumbnailSize;
+
+/** Returns the image with the given key if it's already in the cache, else nil. */
+- (NSImage*) imageForKey: (NSString*)key thumbnail: (BOOL)thumbnail;
+
+/** Gets an image, asynchronously. If it's already cached, onLoaded is called immediately;
+    otherwise the image data is read from the URL and decoded on a background queue, added to the
+    cache, and passed to onLoaded on the main thread (or nil if it couldn't be loaded.)
+    Concurrent requests for the same image share a single load. */
+- (void) loadImageForKey: (NSString*)key
+                 fromURL: (NSURL*)url
+               thumbnail: (BOOL)thumbnail
+                onLoaded: (DemoImageCacheBlock)onLoaded;
+
+/** Adds an already-decoded image to the cache. */
+- (void) setImage: (NSImage*)image forKey: (NSString*)key thumbnail: (BOOL)thumbnail;
+
+- (void) removeAllImages;
+
+@end
@@ -0,0 +1,226 @@
+//
+//  DemoImageCache.m
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+//  Licensed under the Apache License, Version 2.0 (the "License"); you may not use this file
+//  except in compliance with the License. You may obtain a copy of the License at
+//    http://www.apache.org/licenses/LICENSE-2.0
+//  Unless required by applicable law or agreed to in writing, software distributed under the
+//  License is distributed on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+//  either express or implied. See the License for the specific language governing permissions
+//  and limitations under the License.
+
+#import "DemoImageCache.h"
+#import <ImageIO/ImageIO.h>
+
+
+#define kDefaultByteBudget (32*1024*1024)
+#define kDefaultThumbnailSize 64
+
+
+static NSString* cacheKey(NSString* key, BOOL thumbnail) {
+    return thumbnail ? [key stringByAppendingString: @" thumb"] : key;
+}
+
+
+static NSUInteger imageCost(NSImage* image) {
+    NSUInteger cost = 0;
+    for (NSImageRep* rep in image.representations)
+        cost += rep.pixelsWide * rep.pixelsHigh * 4;
+    return cost;
+}
+
+
+// Decodes image data into a bitmap, on the calling thread. Thumbnails are decoded directly at
+// the reduced size, so the full-size bitmap is never created.
+static NSImage* decodeImage(NSData* data, BOOL thumbnail, CGFloat thumbnailSize) {
+    CGImageSourceRef source = CGImageSourceCreateWithData((CFDataRef)data, NULL);
+    if (!source)
+        return nil;
+    CGImageRef cgImage;
+    if (thumbnail) {
+        NSDictionary* options = [NSDictionary dictionaryWithObjectsAndKeys:
+                                 (id)kCFBooleanTrue, kCGImageSourceCreateThumbnailFromImageAlways,
+                                 (id)kCFBooleanTrue, kCGImageSourceCreateThumbnailWithTransform,
+                                 [NSNumber numberWithDouble: thumbnailSize],
+                                        kCGImageSourceThumbnailMaxPixelSize,
+                                 nil];
+        cgImage = CGImageSourceCreateThumbnailAtIndex(source, 0, (CFDictionaryRef)options);
+    } else {
+        CGImageRef lazyImage = CGImageSourceCreateImageAtIndex(source, 0, NULL);
+        cgImage = NULL;
+        if (lazyImage) {
+            // Draw it into a bitmap now, so the decompression doesn't happen later on the
+            // main thread when the image is first drawn:
+            size_t width = CGImageGetWidth(lazyImage), height = CGImageGetHeight(lazyImage);
+            CGColorSpaceRef colorSpace = CGColorSpaceCreateDeviceRGB();
+            CGContextRef ctx = CGBitmapContextCreate(NULL, width, height, 8, 0, colorSpace,
+                                                     kCGImageAlphaPremultipliedFirst);
+            CGColorSpaceRelease(colorSpace);
+            if (ctx) {
+                CGContextDrawImage(ctx, CGRectMake(0, 0, width, height), lazyImage);
+                cgImage = CGBitmapContextCreateImage(ctx);
+                CGContextRelease(ctx);
+            }
+            CGImageRelease(lazyImage);
+        }
+    }
+    CFRelease(source);
+    if (!cgImage)
+        return nil;
+    NSImage* image = [[NSImage alloc] initWithCGImage: cgImage size: NSZeroSize];
+    CGImageRelease(cgImage);
+    return [image autorelease];
+}
+
+
+@interface DemoImageCache ()
+- (void) evict;
+@end
+
+
+@implementation DemoImageCache
+
+
++ (DemoImageCache*) sharedInstance {
+    static DemoImageCache* sInstance;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sInstance = [[self alloc] init];
+    });
+    return sInstance;
+}
+
+
+- (id)init {
+    self = [super init];
+    if (self) {
+        _entries = [[NSMutableDictionary alloc] init];
+        _lru = [[NSMutableArray alloc] init];
+        _waiters = [[NSMutableDictionary alloc] init];
+        _byteBudget = kDefaultByteBudget;
+        _thumbnailSize = kDefaultThumbnailSize;
+        _queue = dispatch_queue_create("DemoImageCache", DISPATCH_QUEUE_CONCURRENT);
+    }
+    return self;
+}
+
+
+- (void)dealloc {
+    dispatch_release(_queue);
+    [_waiters release];
+    [_lru release];
+    [_entries release];
+    [super dealloc];
+}
+
+
+@synthesize totalCost=_totalCost, thumbnailSize=_thumbnailSize;
+
+
+- (NSUInteger) byteBudget {
+    return _byteBudget;
+}
+
+- (void) setByteBudget: (NSUInteger)byteBudget {
+    _byteBudget = byteBudget;
+    [self evict];
+}
+
+
+- (NSImage*) imageForKey: (NSString*)key thumbnail: (BOOL)thumbnail {
+    if (!key)
+        return nil;
+    key = cacheKey(key, thumbnail);
+    NSImage* image = [_entries objectForKey: key];
+    if (image) {
+        // Mark it as most recently used:
+        [_lru removeObject: key];
+        [_lru addObject: key];
+    }
+    return image;
+}
+
+
+- (void) setImage: (NSImage*)image forKey: (NSString*)key thumbnail: (BOOL)thumbnail {
+    NSParameterAssert(key);
+    key = cacheKey(key, thumbnail);
+    NSImage* old = [_entries objectForKey: key];
+    if (old) {
+        _totalCost -= imageCost(old);
+        [_lru removeObject: key];
+    }
+    if (image) {
+        [_entries setObject: image forKey: key];
+        [_lru addObject: key];
+        _totalCost += imageCost(image);
+        [self evict];
+    } else {
+        [_entries removeObjectForKey: key];
+    }
+}
+
+
+- (void) evict {
+    // Keep the most recently used image even if it's over budget by itself:
+    while (_totalCost > _byteBudget && _lru.count > 1) {
+        NSString* key = [_lru objectAtIndex: 0];
+        _totalCost -= imageCost([_entries objectForKey: key]);
+        [_entries removeObjectForKey: key];
+        [_lru removeObjectAtIndex: 0];
+    }
+}
+
+
+- (void) removeAllImages {
+    [_entries removeAllObjects];
+    [_lru removeAllObjects];
+    _totalCost = 0;
+}
+
+
+- (void) loadImageForKey: (NSString*)key
+                 fromURL: (NSURL*)url
+               thumbnail: (BOOL)thumbnail
+                onLoaded: (DemoImageCacheBlock)onLoaded
+{
+    NSImage* image = [self imageForKey: key thumbnail: thumbnail];
+    if (image || !key || !url) {
+        onLoaded(image);
+        return;
+    }
+
+    // If this image is already being loaded, just wait for it:
+    NSString* fullKey = cacheKey(key, thumbnail);
+    NSMutableArray* waiters = [_waiters objectForKey: fullKey];
+    if (waiters) {
+        [waiters addObject: [[onLoaded copy] autorelease]];
+        return;
+    }
+    waiters = [NSMutableArray arrayWithObject: [[onLoaded copy] autorelease]];
+    [_waiters setObject: waiters forKey: fullKey];
+
+    CGFloat thumbnailSize = _thumbnailSize;
+    dispatch_async(_queue, ^{
+        @autoreleasepool {
+            NSURLRequest* request = [NSURLRequest requestWithURL: url];
+            NSData* data = [NSURLConnection sendSynchronousRequest: request
+                                                 returningResponse: NULL error: NULL];
+            NSImage* decoded = data ? decodeImage(data, thumbnail, thumbnailSize) : nil;
+            dispatch_async(dispatch_get_main_queue(), ^{
+                if (decoded)
+                    [self setImage: decoded forKey: key thumbnail: thumbnail];
+                NSArray* blocks = [[[_waiters objectForKey: fullKey] retain] autorelease];
+                [_waiters removeObjectForKey: fullKey];
+                for (DemoImageCacheBlock block in blocks)
+                    block(decoded);
+            });
+        }
+    });
+}
+
+
+@end
@@ -26,7 +26,9 @@
     CouchLiveQuery* _query;
     RESTOperation* _op;
     NSMutableArray* _entries;
+    NSDictionary* _revisions;
     Class _modelClass;
+    BOOL _incremental;
 }
 
 - (id) initWithQuery: (CouchQuery*)query;
@@ -34,6 +36,12 @@
 /** Class to instantiate for entries. Defaults to DemoItem. */
 @property (assign) Class modelClass;
 
+/** If YES (the default), query changes are applied to the entries incrementally: rows are matched
+    to existing entries by document ID and revision, unchanged rows are left alone, and observers
+    get fine-grained insertion/removal/replacement notifications. If NO, every change reloads the
+    whole array and posts a single coarse change notification. */
+@property BOOL incremental;
+
 /** The documents returned by the query, wrapped in DemoItem objects.
     An NSArrayController can be bound to this property. */
 //@property (readonly) NSMutableArray* entries;
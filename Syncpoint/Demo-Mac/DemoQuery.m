@@ -31,6 +31,7 @@
     self = [super init];
     if (self != nil) {
         _modelClass = [CouchModel class];
+        _incremental = YES;
         _query = [[query asLiveQuery] retain];
 
         _query.prefetch = YES;        // for efficiency, include docs on first load
@@ -46,26 +47,39 @@
 - (void) dealloc
 {
     [_entries release];
+    [_revisions release];
     [_query removeObserver: self forKeyPath: @"rows"];
     [_query release];
     [super dealloc];
 }
 
 
-@synthesize modelClass=_modelClass;
+@synthesize modelClass=_modelClass, incremental=_incremental;
+
+
+// Maps each row's document ID to the revision ID it was indexed from.
+static NSDictionary* revisionsOfRows(CouchQueryEnumerator* rows) {
+    NSMutableDictionary* revisions = [NSMutableDictionary dictionaryWithCapacity: rows.count];
+    for (CouchQueryRow* row in rows) {
+        id revID = row.documentRevision;
+        [revisions setObject: (revID ? revID : [NSNull null]) forKey: row.documentID];
+    }
+    return revisions;
+}
 
 
 - (void) loadEntriesFrom: (CouchQueryEnumerator*)rows {
     NSLog(@"Reloading %lu rows from sequence #%lu...",
           (unsigned long)rows.count, (unsigned long)rows.sequenceNumber);
     NSMutableArray* entries = [NSMutableArray array];
+    NSSet* oldEntries = _entries ? [NSSet setWithArray: _entries] : nil;
 
     for (CouchQueryRow* row in rows) {
         CouchModel* item = [_modelClass modelForDocument: row.document];
         item.autosaves = YES;
         [entries addObject: item];
         // If this item isn't in the prior _entries, it's an external insertion:
-        if (_entries && [_entries indexOfObjectIdenticalTo: item] == NSNotFound)
+        if (oldEntries && ![oldEntries member: item])
             [item markExternallyChanged];
     }
 
@@ -74,6 +88,9 @@
             [entries addObject: item];
     }
     
+    [_revisions release];
+    _revisions = [revisionsOfRows(rows) retain];
+
     if (![entries isEqual:_entries]) {
         NSLog(@"    ...entries changed! (was %u, now %u)", 
               (unsigned)_entries.count, (unsigned)entries.count);
@@ -85,11 +102,105 @@
 }
 
 
+/** Applies the rows to _entries as a series of removals, insertions and replacements, touching
+    only the entries whose documents were added, deleted or updated.
+    Returns NO without changing anything if the rows have been reordered relative to the existing
+    entries; the caller should then fall back to -loadEntriesFrom:. */
+- (BOOL) updateEntriesFrom: (CouchQueryEnumerator*)rows {
+    if (!_entries)
+        return NO;
+    NSDictionary* revisions = revisionsOfRows(rows);
+
+    // Find the entries whose documents have left the query. New, unsaved entries stay.
+    NSMutableIndexSet* removed = [NSMutableIndexSet indexSet];
+    NSMutableArray* survivorIDs = [NSMutableArray arrayWithCapacity: _entries.count];
+    BOOL sawNewItem = NO;
+    NSUInteger index = 0;
+    for (CouchModel* item in _entries) {
+        if (item.isNew) {
+            sawNewItem = YES;
+        } else {
+            NSString* docID = item.document.documentID;
+            if (![revisions objectForKey: docID])
+                [removed addIndex: index];
+            else if (sawNewItem)
+                return NO;      // Saved entry following a new one: needs a full reload to reorder
+            else
+                [survivorIDs addObject: docID];
+        }
+        ++index;
+    }
+
+    // Check that the surviving entries are in the same relative order as the rows, and find
+    // the rows that are new or have been updated:
+    NSSet* survivors = [NSSet setWithArray: survivorIDs];
+    NSMutableIndexSet* inserted = [NSMutableIndexSet indexSet];
+    NSMutableArray* insertedRows = [NSMutableArray array];
+    NSMutableIndexSet* replaced = [NSMutableIndexSet indexSet];
+    NSUInteger nextSurvivor = 0;
+    index = 0;
+    for (CouchQueryRow* row in rows) {
+        NSString* docID = row.documentID;
+        if ([survivors member: docID]) {
+            if (![docID isEqualToString: [survivorIDs objectAtIndex: nextSurvivor++]])
+                return NO;
+            if (![[revisions objectForKey: docID] isEqual: [_revisions objectForKey: docID]])
+                [replaced addIndex: index];
+        } else {
+            [inserted addIndex: index];
+            [insertedRows addObject: row];
+        }
+        ++index;
+    }
+
+    if (removed.count == 0 && inserted.count == 0 && replaced.count == 0) {
+        [_revisions release];
+        _revisions = [revisions retain];
+        return YES;
+    }
+    NSLog(@"Updating entries from sequence #%lu: %lu removed, %lu inserted, %lu changed",
+          (unsigned long)rows.sequenceNumber, (unsigned long)removed.count,
+          (unsigned long)inserted.count, (unsigned long)replaced.count);
+
+    if (removed.count > 0) {
+        [self willChange: NSKeyValueChangeRemoval valuesAtIndexes: removed forKey: @"entries"];
+        [_entries removeObjectsAtIndexes: removed];
+        [self didChange: NSKeyValueChangeRemoval valuesAtIndexes: removed forKey: @"entries"];
+    }
+
+    if (inserted.count > 0) {
+        NSMutableArray* insertedItems = [NSMutableArray arrayWithCapacity: insertedRows.count];
+        for (CouchQueryRow* row in insertedRows) {
+            CouchModel* item = [_modelClass modelForDocument: row.document];
+            item.autosaves = YES;
+            [item markExternallyChanged];
+            [insertedItems addObject: item];
+        }
+        [self willChange: NSKeyValueChangeInsertion valuesAtIndexes: inserted forKey: @"entries"];
+        [_entries insertObjects: insertedItems atIndexes: inserted];
+        [self didChange: NSKeyValueChangeInsertion valuesAtIndexes: inserted forKey: @"entries"];
+    }
+
+    [_revisions release];
+    _revisions = [revisions retain];
+
+    if (replaced.count > 0) {
+        // The models pick up the new revisions themselves; this just tells observers which
+        // entries to redisplay.
+        [self willChange: NSKeyValueChangeReplacement valuesAtIndexes: replaced forKey: @"entries"];
+        [self didChange: NSKeyValueChangeReplacement valuesAtIndexes: replaced forKey: @"entries"];
+    }
+    return YES;
+}
+
+
 - (void)observeValueForKeyPath: (NSString*)keyPath ofObject: (id)object
                         change: (NSDictionary*)change context: (void*)context 
 {
     if (object == _query) {
-        [self loadEntriesFrom: _query.rows];
+        CouchQueryEnumerator* rows = _query.rows;
+        if (!_incremental || ![self updateEntriesFrom: rows])
+            [self loadEntriesFrom: rows];
     }
 }
 
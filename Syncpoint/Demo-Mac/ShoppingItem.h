@@ -13,12 +13,26 @@
 @interface ShoppingItem : CouchModel
 {
     NSImage* _picture;
+    NSImage* _pictureToEncode;
+    BOOL _encodingPicture;
+    NSString* _pictureDigest;
+    NSString* _loadingPictureKey, *_loadingThumbnailKey;
 }
 
 @property bool check;       // bool is better than BOOL: it maps to true/false in JSON, not 0/1.
 @property (copy) NSString* text;
 @property (retain) NSDate* created_at;
 
+/** The full-size picture. It's loaded lazily from the attachment through the shared
+    DemoImageCache: if it isn't cached yet this returns nil, and a KVO notification is posted
+    when it finishes loading in the background.
+    Setting the picture takes effect immediately in memory, but the JPEG encoding happens on a
+    background queue. The attachment isn't rewritten if the encoded data matches the existing
+    attachment's digest, and if the picture is set several times while an encoding is in
+    progress, only the last one is written. */
 @property (retain) NSImage* picture;
 
+/** A downscaled version of the picture, for display in lists. Loaded like the picture. */
+@property (readonly) NSImage* thumbnail;
+
 @end
@@ -14,10 +14,19 @@
 //  and limitations under the License.
 
 #import "ShoppingItem.h"
+#import "DemoImageCache.h"
 #import <AppKit/NSImage.h>
+#import <CommonCrypto/CommonDigest.h>
 
 
 static NSData* ImageJPEGData(NSImage* image);
+static NSString* DigestLike(NSString* existingDigest, NSData* data);
+static dispatch_queue_t EncodingQueue(void);
+
+
+@interface ShoppingItem ()
+- (void) encodeNextPicture;
+@end
 
 
 
@@ -25,6 +34,10 @@ static NSData* ImageJPEGData(NSImage* image);
 
 
 - (void)dealloc {
+    [_loadingThumbnailKey release];
+    [_loadingPictureKey release];
+    [_pictureDigest release];
+    [_pictureToEncode release];
     [_picture release];
     [super dealloc];
 }
@@ -41,25 +54,123 @@ static NSData* ImageJPEGData(NSImage* image);
 }
 
 
+// The cache key of the saved picture attachment: its digest.
+- (NSString*) pictureKey {
+    return [[[self attachmentNamed: @"picture"] metadata] objectForKey: @"digest"];
+}
+
+
+// Returns the cached picture or thumbnail if there is one; otherwise starts loading it and
+// returns nil, posting a KVO notification for the property when it arrives.
+- (NSImage*) cachedPicture: (BOOL)thumbnail property: (NSString*)property {
+    NSString* key = self.pictureKey;
+    if (!key)
+        return nil;
+    DemoImageCache* cache = [DemoImageCache sharedInstance];
+    NSImage* image = [cache imageForKey: key thumbnail: thumbnail];
+    if (image)
+        return image;
+
+    NSString** loadingKey = thumbnail ? &_loadingThumbnailKey : &_loadingPictureKey;
+    if ([*loadingKey isEqualToString: key])
+        return nil;     // already loading
+    [*loadingKey release];
+    *loadingKey = [key copy];
+    NSURL* url = [[self attachmentNamed: @"picture"] URL];
+    [self retain];
+    [cache loadImageForKey: key fromURL: url thumbnail: thumbnail onLoaded: ^(NSImage* loaded) {
+        if ([*loadingKey isEqualToString: key]) {
+            [*loadingKey release];
+            *loadingKey = nil;
+            if (loaded) {
+                [self willChangeValueForKey: property];
+                [self didChangeValueForKey: property];
+            }
+        }
+        [self release];
+    }];
+    return nil;
+}
+
+
 - (NSImage*) picture {
-    if (!_picture) {
-        NSData* pictureData = [[self attachmentNamed: @"picture"] body];
-        if (pictureData)
-            _picture = [[NSImage alloc] initWithData: pictureData];
-    }
-    return _picture;
+    // A picture that was set locally is kept until the document is next reloaded:
+    if (_picture)
+        return _picture;
+    return [self cachedPicture: NO property: @"picture"];
+}
+
+
+- (NSImage*) thumbnail {
+    return [self cachedPicture: YES property: @"thumbnail"];
+}
+
+
++ (NSSet*) keyPathsForValuesAffectingThumbnail {
+    return [NSSet setWithObject: @"picture"];
 }
 
 
 - (void) setPicture:(NSImage *)picture {
     if (_picture && picture == _picture)
         return;
-    
-    [self createAttachmentWithName: @"picture"
-                              type: @"image/jpeg"
-                              body: ImageJPEGData(picture)];
     [_picture release];
     _picture = [picture retain];
+
+    [_pictureToEncode release];
+    _pictureToEncode = nil;
+    if (!picture) {
+        [self createAttachmentWithName: @"picture" type: @"image/jpeg" body: nil];
+        return;
+    }
+    _pictureToEncode = [picture retain];
+    // If an encoding is already in progress, the new picture will be picked up when it finishes.
+    if (!_encodingPicture)
+        [self encodeNextPicture];
+}
+
+
+- (void) encodeNextPicture {
+    NSImage* image = [_pictureToEncode autorelease];
+    _pictureToEncode = nil;
+    if (!image)
+        return;
+    _encodingPicture = YES;
+    NSString* currentDigest = self.pictureKey;
+    [self retain];
+    dispatch_async(EncodingQueue(), ^{
+        NSData* jpeg = ImageJPEGData(image);
+        BOOL unchanged = currentDigest && [DigestLike(currentDigest, jpeg) isEqualToString: currentDigest];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            _encodingPicture = NO;
+            if (_pictureToEncode) {
+                // Superseded by a newer picture while encoding; don't bother writing this one.
+                [self encodeNextPicture];
+            } else if (_picture == image && !unchanged) {
+                // (Nothing to write if the picture was cleared while encoding, or if the JPEG
+                // is identical to the existing attachment.)
+                [self createAttachmentWithName: @"picture" type: @"image/jpeg" body: jpeg];
+            }
+            [self release];
+        });
+    });
+}
+
+
+- (void) didLoadFromDocument {
+    [super didLoadFromDocument];
+    NSString* digest = self.pictureKey;
+    if (digest && ![digest isEqualToString: _pictureDigest]
+            && !_encodingPicture && !_pictureToEncode) {
+        // The attachment has been saved, or changed remotely. Either way the picture can now be
+        // loaded through the cache, so there's no need to hold onto the full-size image:
+        [self willChangeValueForKey: @"picture"];
+        [_picture release];
+        _picture = nil;
+        [_pictureDigest release];
+        _pictureDigest = [digest copy];
+        [self didChangeValueForKey: @"picture"];
+    }
 }
 
 
@@ -79,3 +190,46 @@ static NSData* ImageJPEGData(NSImage* image) {
     NSCAssert(bitmapRep != nil, @"No bitmap rep");
     return [bitmapRep representationUsingType: NSJPEGFileType properties: nil];
 }
+
+
+static dispatch_queue_t EncodingQueue(void) {
+    static dispatch_queue_t sQueue;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sQueue = dispatch_queue_create("ShoppingItem.encoding", NULL);
+    });
+    return sQueue;
+}
+
+
+static NSString* Base64(const uint8_t* bytes, size_t length) {
+    static const char kChars[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    NSMutableString* result = [NSMutableString stringWithCapacity: (length + 2) / 3 * 4];
+    for (size_t i = 0; i < length; i += 3) {
+        uint32_t n = bytes[i] << 16;
+        if (i + 1 < length) n |= bytes[i+1] << 8;
+        if (i + 2 < length) n |= bytes[i+2];
+        [result appendFormat: @"%c%c%c%c",
+             kChars[(n >> 18) & 63], kChars[(n >> 12) & 63],
+             (i + 1 < length) ? kChars[(n >> 6) & 63] : '=',
+             (i + 2 < length) ? kChars[n & 63] : '='];
+    }
+    return result;
+}
+
+
+// Computes the digest of the data using the same algorithm as an existing attachment digest
+// ("sha1-..." from TouchDB, "md5-..." from CouchDB), or returns nil if it's an unknown type.
+static NSString* DigestLike(NSString* existingDigest, NSData* data) {
+    if ([existingDigest hasPrefix: @"sha1-"]) {
+        uint8_t digest[CC_SHA1_DIGEST_LENGTH];
+        CC_SHA1(data.bytes, (CC_LONG)data.length, digest);
+        return [@"sha1-" stringByAppendingString: Base64(digest, sizeof(digest))];
+    } else if ([existingDigest hasPrefix: @"md5-"]) {
+        uint8_t digest[CC_MD5_DIGEST_LENGTH];
+        CC_MD5(data.bytes, (CC_LONG)data.length, digest);
+        return [@"md5-" stringByAppendingString: Base64(digest, sizeof(digest))];
+    }
+    return nil;
+}
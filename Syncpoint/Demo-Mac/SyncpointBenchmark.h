@@ -0,0 +1,21 @@
+//
+//  SyncpointBenchmark.h
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+
+/** Runs the SyncpointClient scale benchmark against an in-process SyncpointFakeServer, sweeping
+    the number of channels, documents per channel and control-database churn, and prints a
+    table of results (cold and warm time-to-ready, time to sync all channels, reconciliation
+    time, memory high-water mark, replication counts) to stdout. It then compares the time for a
+    large new channel to become usable when replicated document by document versus bootstrapped
+    from a snapshot. Finally it saves the trace buffer to a temporary file.
+    It uses its own TouchDB directory and user defaults, so the demo app's data is left alone.
+    Invoke by launching the Mac demo app with a "--benchmark" argument.
+    @return  A process exit status. */
+int RunSyncpointBenchmark(void);
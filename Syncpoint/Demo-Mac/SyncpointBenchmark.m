@@ -0,0 +1,459 @@
+//
+//  SyncpointBenchmark.m
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import "SyncpointBenchmark.h"
+#import "SyncpointFakeServer.h"
+#import <Syncpoint/Syncpoint.h>
+#import "Test.h"
+#import <mach/mach.h>
+
+
+#define kTimeout 600.0
+
+
+/** Authenticator that pairs immediately, with a made-up token. */
+@interface BenchmarkAuthenticator : SyncpointAuthenticator
+@end
+
+@implementation BenchmarkAuthenticator
+
+- (NSString*) authDocType {
+    return @"session-benchmark";
+}
+
+- (void) initiatePairing {
+    [self.syncpoint authenticator: self authenticatedWithToken: @"benchmark" ofType: @"benchmark_token"];
+}
+
+- (BOOL) validateToken {
+    return NO;
+}
+
+@end
+
+
+static size_t sMemoryHighWater;
+
+static void sampleMemory(void) {
+    struct task_basic_info info;
+    mach_msg_type_number_t count = TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), TASK_BASIC_INFO, (task_info_t)&info, &count) == KERN_SUCCESS)
+        sMemoryHighWater = MAX(sMemoryHighWater, info.resident_size);
+}
+
+
+// Runs the runloop until the condition is true, or the timeout expires.
+static BOOL waitFor(BOOL (^condition)(void)) {
+    NSDate* limit = [NSDate dateWithTimeIntervalSinceNow: kTimeout];
+    while (!condition()) {
+        if ([limit timeIntervalSinceNow] < 0)
+            return NO;
+        sampleMemory();
+        [[NSRunLoop currentRunLoop] runMode: NSDefaultRunLoopMode
+                                 beforeDate: [NSDate dateWithTimeIntervalSinceNow: 0.05]];
+    }
+    return YES;
+}
+
+
+// Are all of the client's channel replications (and the control DB's) caught up?
+static BOOL allSynced(SyncpointClient* client, NSUInteger numChannels) {
+    NSDictionary* snapshot = client.metricsSnapshot;
+    NSDictionary* installations = [snapshot objectForKey: @"installations"];
+    if (installations.count < numChannels)
+        return NO;
+    NSMutableArray* all = [NSMutableArray arrayWithArray: installations.allValues];
+    [all addObject: [snapshot objectForKey: @"control"]];
+    for (NSDictionary* metrics in all) {
+        if ([[metrics objectForKey: @"lag"] unsignedIntegerValue] > 0
+                || [[metrics objectForKey: @"time_since_sync"] doubleValue] < 0)
+            return NO;
+    }
+    return YES;
+}
+
+
+// Deletes all local Syncpoint state, so the next client does a cold start. This only touches the
+// benchmark's own server and defaults (see RunSyncpointBenchmark), never the demo app's.
+static void resetLocalState(CouchServer* server) {
+    for (CouchPersistentReplication* repl in server.replications)
+        [[repl deleteDocument] wait];
+    for (CouchDatabase* db in server.getDatabases) {
+        NSString* name = db.relativePath;
+        if ([name isEqualToString: @"sp_control"] || [name hasPrefix: @"channel-"])
+            [[db DELETE] wait];
+    }
+    NSUserDefaults* defaults = [NSUserDefaults standardUserDefaults];
+    [defaults removeObjectForKey: @"Syncpoint_SessionDocID"];
+    [defaults removeObjectForKey: @"Syncpoint_SessionDocIDs"];
+    [defaults removeObjectForKey: @"Syncpoint_ControlSequence"];
+}
+
+
+static SyncpointClient* makeClientWithRemote(CouchServer* server, NSURL* remoteURL) {
+    NSError* error;
+    SyncpointClient* client = [[SyncpointClient alloc] initWithLocalServer: server
+                                                              remoteServer: remoteURL
+                                                                     appId: @"benchmark"
+                                                                     error: &error];
+    if (!client)
+        fprintf(stderr, "Couldn't create SyncpointClient: %s\n",
+                error.localizedDescription.UTF8String);
+    return client;
+}
+
+
+static SyncpointClient* makeClient(CouchServer* server, SyncpointFakeServer* fakeServer) {
+    return makeClientWithRemote(server, fakeServer.URL);
+}
+
+
+// Releases a client for good. Its pending delayed performs would otherwise keep it alive, still
+// reacting to control-database changes alongside the next client.
+static void disposeOfClient(SyncpointClient* client) {
+    [NSObject cancelPreviousPerformRequestsWithTarget: client];
+    [client release];
+}
+
+
+static BOOL runOne(CouchServer* server, SyncpointFakeServer* fakeServer,
+                   NSUInteger numChannels, NSUInteger docsPerChannel, NSUInteger churn)
+{
+    resetLocalState(server);
+    [fakeServer deleteDatabases];
+    fakeServer.docsPerChannel = docsPerChannel;
+    sMemoryHighWater = 0;
+    sampleMemory();
+
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    SyncpointClient* client = makeClient(server, fakeServer);
+    if (!client)
+        return NO;
+    [client authenticate: [[[BenchmarkAuthenticator alloc] init] autorelease]];
+    NSMutableDictionary* channels = [NSMutableDictionary dictionary];
+    for (NSUInteger i = 0; i < numChannels; ++i)
+        [channels setObject: [NSNull null] forKey: [NSString stringWithFormat: @"bench-%lu", (unsigned long)i]];
+    [client.session beginInstallingChannels: channels];
+
+    BOOL ok = waitFor(^{ return (BOOL)(client.state == kSyncpointReady); });
+    NSTimeInterval timeToReady = client.timeToReady;
+    ok = ok && waitFor(^{ return allSynced(client, numChannels); });
+    NSTimeInterval timeToSynced = CFAbsoluteTimeGetCurrent() - start;
+
+    NSTimeInterval reconcileBefore = client.reconcileTime;
+    if (ok && churn > 0) {
+        [fakeServer churnControlDatabases: churn];
+        // Give the change a moment to propagate before waiting for things to settle:
+        [[NSRunLoop currentRunLoop] runUntilDate: [NSDate dateWithTimeIntervalSinceNow: 0.5]];
+        ok = waitFor(^{ return allSynced(client, numChannels); });
+    }
+    NSTimeInterval churnReconcileTime = client.reconcileTime - reconcileBefore;
+
+    NSUInteger numReplications = 2 * [[client.metricsSnapshot objectForKey: @"installations"] count] + 2;
+    NSTimeInterval reconcileTime = client.reconcileTime;
+    NSUInteger suppressedStarts = client.suppressedReplicationStarts;
+    disposeOfClient(client);
+
+    // Relaunch on the same local state, to compare a warm start with the cold one:
+    NSTimeInterval warmTimeToReady = 0;
+    BOOL warmStarted = NO;
+    if (ok) {
+        SyncpointClient* warmClient = makeClient(server, fakeServer);
+        if (warmClient) {
+            ok = waitFor(^{ return (BOOL)(warmClient.state == kSyncpointReady); });
+            warmTimeToReady = warmClient.timeToReady;
+            warmStarted = warmClient.warmStarted;
+            disposeOfClient(warmClient);
+        } else {
+            ok = NO;
+        }
+    }
+
+    printf("%8lu %8lu %6lu | %10.3f %10.3f %c %9.3f %10.4f %10.4f | %8.1f | %5lu %10lu %s\n",
+           (unsigned long)numChannels, (unsigned long)docsPerChannel, (unsigned long)churn,
+           timeToReady, warmTimeToReady, (warmStarted ? 'W' : '-'),
+           timeToSynced, reconcileTime, churnReconcileTime,
+           sMemoryHighWater / 1.0e6,
+           (unsigned long)numReplications, (unsigned long)suppressedStarts,
+           (ok ? "" : "TIMED OUT"));
+    fflush(stdout);
+    return ok;
+}
+
+
+// Measures the time from a channel becoming ready on the server until its local database is
+// usable (fully synced), either replicating it document by document or bootstrapping it from
+// a snapshot.
+static BOOL runBootstrap(CouchServer* server, SyncpointFakeServer* fakeServer,
+                         NSUInteger docsPerChannel, BOOL useSnapshot)
+{
+    resetLocalState(server);
+    [fakeServer deleteDatabases];
+    fakeServer.docsPerChannel = docsPerChannel;
+    fakeServer.makesSnapshots = useSnapshot;
+
+    SyncpointClient* client = makeClient(server, fakeServer);
+    if (!client)
+        return NO;
+    client.bootstrapsFromSnapshots = useSnapshot;
+    [client authenticate: [[[BenchmarkAuthenticator alloc] init] autorelease]];
+    [client.session beginInstallingChannelNamed: @"bench-0" toDatabase: nil];
+
+    BOOL ok = waitFor(^{ return (BOOL)(client.state == kSyncpointReady); });
+    ok = ok && waitFor(^{ return (BOOL)[client.session channelWithName: @"bench-0"].isReady; });
+    CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+    ok = ok && waitFor(^{ return allSynced(client, 1); });
+    NSTimeInterval timeToUsable = CFAbsoluteTimeGetCurrent() - start;
+    SyncpointInstallation* inst = [client.session channelWithName: @"bench-0"].installation;
+    NSInteger localDocs = inst.localDatabase.getDocumentCount;
+
+    printf("%8lu %-9s | %9.3f | %9ld %s\n",
+           (unsigned long)docsPerChannel, (useSnapshot ? "snapshot" : "per-doc"),
+           timeToUsable, (long)localDocs, (ok ? "" : "TIMED OUT"));
+    fflush(stdout);
+    disposeOfClient(client);
+    return ok;
+}
+
+
+// The benchmark keeps its databases in a scratch directory of their own, emptied on each run:
+static NSString* benchmarkServerPath(void) {
+    return [NSTemporaryDirectory() stringByAppendingPathComponent: @"SyncpointBenchmark"];
+}
+
+
+// Syncpoint keeps its session state in the standard user defaults. While the benchmark runs, the
+// app's own defaults are moved aside to a separate domain and the benchmark gets a clean one; they
+// are put back afterwards (or on the next run, if the benchmark didn't finish.)
+static NSString* appDefaultsDomain(void) {
+    return [[NSBundle mainBundle] bundleIdentifier];
+}
+
+static NSString* savedDefaultsDomain(void) {
+    return [appDefaultsDomain() stringByAppendingString: @".benchmark-saved"];
+}
+
+static void restoreAppDefaults(void) {
+    NSUserDefaults* defaults = [NSUserDefaults standardUserDefaults];
+    NSDictionary* saved = [defaults persistentDomainForName: savedDefaultsDomain()];
+    if (!saved)
+        return;
+    [defaults setPersistentDomain: saved forName: appDefaultsDomain()];
+    [defaults removePersistentDomainForName: savedDefaultsDomain()];
+    [defaults synchronize];
+}
+
+static void setAsideAppDefaults(void) {
+    restoreAppDefaults();
+    NSUserDefaults* defaults = [NSUserDefaults standardUserDefaults];
+    NSDictionary* appDefaults = [defaults persistentDomainForName: appDefaultsDomain()];
+    if (!appDefaults)
+        appDefaults = [NSDictionary dictionary];
+    [defaults setPersistentDomain: appDefaults forName: savedDefaultsDomain()];
+    [defaults removePersistentDomainForName: appDefaultsDomain()];
+    [defaults synchronize];
+}
+
+
+// Points a client at a server that's down for a while, and counts how often the server gets
+// retried: the connection-health manager should probe it with backoff, however many replications
+// are failing.
+static BOOL runOutage(CouchServer* server, SyncpointFakeServer* fakeServer, NSTimeInterval duration) {
+    resetLocalState(server);
+    SyncpointClient* client = makeClientWithRemote(server, fakeServer.failingURL);
+    if (!client)
+        return NO;
+    SyncpointConnectionHealth* health = client.connectionHealth;
+    health.initialRetryDelay = 0.1;
+    health.maxRetryDelay = 2.0;
+    [client authenticate: [[[BenchmarkAuthenticator alloc] init] autorelease]];
+    [[NSRunLoop currentRunLoop] runUntilDate: [NSDate dateWithTimeIntervalSinceNow: duration]];
+
+    BOOL ok = !health.serverReachable && health.outageCount == 1;
+    printf("%8.0f | %8lu %6lu %7lu %7lu | %8.2f %s\n",
+           duration, (unsigned long)health.failureCount, (unsigned long)health.probeCount,
+           (unsigned long)health.retryCount, (unsigned long)health.outageCount,
+           health.currentRetryDelay, (ok ? "" : "UNEXPECTED"));
+    fflush(stdout);
+    disposeOfClient(client);
+    return ok;
+}
+
+
+// Syncs channels in one mode while making local changes for a while, and reports how often the
+// replications woke up and how much they transferred.
+static BOOL runSyncMode(CouchServer* server, SyncpointFakeServer* fakeServer,
+                        SyncpointSyncMode mode, NSUInteger numChannels, NSTimeInterval duration)
+{
+    resetLocalState(server);
+    [fakeServer deleteDatabases];
+    fakeServer.docsPerChannel = 10;
+    SyncpointClient* client = makeClient(server, fakeServer);
+    if (!client)
+        return NO;
+    client.burstInterval = 5.0;
+    client.burstChangeThreshold = 20;
+    NSMutableDictionary* channels = [NSMutableDictionary dictionary];
+    for (NSUInteger i = 0; i < numChannels; ++i) {
+        NSString* name = [NSString stringWithFormat: @"bench-%lu", (unsigned long)i];
+        [channels setObject: [NSNull null] forKey: name];
+        [client setSyncMode: mode forChannelNamed: name];
+    }
+    [client authenticate: [[[BenchmarkAuthenticator alloc] init] autorelease]];
+    [client.session beginInstallingChannels: channels];
+    BOOL ok = waitFor(^{ return allSynced(client, numChannels); });
+
+    // Edit a random channel's local database a few times a second:
+    NSMutableArray* databases = [NSMutableArray array];
+    for (SyncpointInstallation* inst in client.session.allInstallations)
+        [databases addObject: inst.localDatabase];
+    NSDate* end = [NSDate dateWithTimeIntervalSinceNow: duration];
+    NSUInteger edits = 0;
+    while (ok && [end timeIntervalSinceNow] > 0) {
+        CouchDatabase* db = [databases objectAtIndex: arc4random() % databases.count];
+        NSDictionary* props = [NSDictionary dictionaryWithObject: [NSNumber numberWithUnsignedInteger: edits++]
+                                                          forKey: @"edit"];
+        [[[db untitledDocument] putProperties: props] wait];
+        [[NSRunLoop currentRunLoop] runUntilDate: [NSDate dateWithTimeIntervalSinceNow: 0.25]];
+    }
+
+    NSDictionary* snapshot = client.metricsSnapshot;
+    NSDictionary* stats = [[snapshot objectForKey: @"sync_modes"]
+                                objectForKey: (mode == kSyncpointBurstSync ? @"burst" : @"continuous")];
+    printf("%-10s %8lu %6lu | %12.0f %11.0f %6lu %s\n",
+           (mode == kSyncpointBurstSync ? "burst" : "continuous"),
+           (unsigned long)numChannels, (unsigned long)edits,
+           [[stats objectForKey: @"wakeups_per_hour"] doubleValue],
+           [[stats objectForKey: @"docs_per_hour"] doubleValue],
+           (unsigned long)[[snapshot objectForKey: @"bursts"] unsignedIntegerValue],
+           (ok ? "" : "TIMED OUT"));
+    fflush(stdout);
+    [client release];
+    return ok;
+}
+
+
+int RunSyncpointBenchmark(void) {
+    @autoreleasepool {
+        NSString* serverPath = benchmarkServerPath();
+        [[NSFileManager defaultManager] removeItemAtPath: serverPath error: NULL];
+        CouchTouchDBServer* server = [[[CouchTouchDBServer alloc] initWithServerPath: serverPath]
+                                            autorelease];
+        if (server.error) {
+            fprintf(stderr, "Couldn't start TouchDB: %s\n", server.error.localizedDescription.UTF8String);
+            return 1;
+        }
+        setAsideAppDefaults();
+        SyncpointFakeServer* fakeServer = [[SyncpointFakeServer alloc] initWithServer: server];
+
+        printf("channels     docs  churn | cold ready warm ready W    synced  reconcile  churn-rec |   mem MB | repls suppressed\n");
+        const NSUInteger kChannelCounts[] = {1, 10, 50, 100};
+        const NSUInteger kDocCounts[] = {10, 100};
+        const NSUInteger kChurn[] = {0, 50};
+        int failures = 0;
+        for (unsigned c = 0; c < sizeof(kChannelCounts)/sizeof(*kChannelCounts); ++c)
+            for (unsigned d = 0; d < sizeof(kDocCounts)/sizeof(*kDocCounts); ++d)
+                for (unsigned h = 0; h < sizeof(kChurn)/sizeof(*kChurn); ++h)
+                    @autoreleasepool {
+                        if (!runOne(server, fakeServer, kChannelCounts[c], kDocCounts[d], kChurn[h]))
+                            ++failures;
+                    }
+
+        printf("\n    docs bootstrap |    usable | local docs\n");
+        const NSUInteger kBootstrapDocCounts[] = {1000, 10000, 100000};
+        for (unsigned d = 0; d < sizeof(kBootstrapDocCounts)/sizeof(*kBootstrapDocCounts); ++d)
+            for (int snapshot = 0; snapshot <= 1; ++snapshot)
+                @autoreleasepool {
+                    if (!runBootstrap(server, fakeServer, kBootstrapDocCounts[d], snapshot))
+                        ++failures;
+                }
+        fakeServer.makesSnapshots = NO;
+
+        printf("\n outage s | failures probes retries outages | delay s\n");
+        if (!runOutage(server, fakeServer, 15.0))
+            ++failures;
+
+        printf("\nmode       channels  edits | wakeups/hour   docs/hour bursts\n");
+        for (int mode = kSyncpointContinuousSync; mode <= kSyncpointBurstSync; ++mode)
+            @autoreleasepool {
+                if (!runSyncMode(server, fakeServer, mode, 10, 30.0))
+                    ++failures;
+            }
+
+        // Save the trace of the whole run, for decoding with --decode-trace or --chrome-trace:
+        NSString* tracePath = [NSTemporaryDirectory() stringByAppendingPathComponent:
+                                                            @"SyncpointBenchmark.sptrace"];
+        NSError* error;
+        if ([SyncpointTrace dumpToFile: tracePath error: &error])
+            printf("\nTrace of the last %lu events saved to %s\n",
+                   (unsigned long)MIN([SyncpointTrace eventCount], [SyncpointTrace bufferCapacity]),
+                   tracePath.fileSystemRepresentation);
+        else
+            fprintf(stderr, "Couldn't save trace: %s\n", error.localizedDescription.UTF8String);
+
+        [fakeServer deleteDatabases];
+        resetLocalState(server);
+        [fakeServer release];
+        restoreAppDefaults();
+        return failures ? 1 : 0;
+    }
+}
+
+
+
+
+#pragma mark - TESTS:
+#if DEBUG
+
+TestCase(SyncpointOutageRecovery) {
+    NSString* serverPath = [NSTemporaryDirectory() stringByAppendingPathComponent: @"SyncpointOutageTest"];
+    [[NSFileManager defaultManager] removeItemAtPath: serverPath error: NULL];
+    CouchTouchDBServer* server = [[[CouchTouchDBServer alloc] initWithServerPath: serverPath]
+                                        autorelease];
+    CAssertNil(server.error);
+    setAsideAppDefaults();
+    SyncpointFakeServer* fakeServer = [[SyncpointFakeServer alloc] initWithServer: server];
+    SyncpointClient* client = makeClientWithRemote(server, fakeServer.failingURL);
+    CAssert(client);
+    SyncpointConnectionHealth* health = client.connectionHealth;
+    health.initialRetryDelay = 0.1;
+    health.maxRetryDelay = 0.4;
+    health.jitter = 0.0;
+    [client authenticate: [[[BenchmarkAuthenticator alloc] init] autorelease]];
+
+    // The handshake pull and push both fail, but the server is only probed once:
+    CAssert(waitFor(^{ return (BOOL)!health.serverReachable; }));
+    CAssertEq(health.outageCount, 1u);
+    CAssertEq(health.probeCount, 1u);
+    CAssertEq(health.retryCount, 0u);
+
+    // While it's down it's retried with backoff, after 0.1, 0.2, 0.4, 0.4... sec; that's about
+    // 8 retries in 3 sec, one probe each:
+    [[NSRunLoop currentRunLoop] runUntilDate: [NSDate dateWithTimeIntervalSinceNow: 3.0]];
+    CAssert(!health.serverReachable);
+    CAssertEq(health.outageCount, 1u);
+    CAssert(health.retryCount >= 3 && health.retryCount <= 9,
+            @"Made %u retries", (unsigned)health.retryCount);
+    CAssertEq(health.probeCount, health.retryCount + 1);
+
+    // Once the server answers, the next retry finds it and the replications are resumed, so
+    // they reach it too:
+    fakeServer.failingURLRecovered = YES;
+    CAssert(waitFor(^{ return health.serverReachable; }));
+    CAssert(waitFor(^{ return (BOOL)(fakeServer.failingURLRequestCount > 1); }));
+    CAssertEq(health.outageCount, 1u);
+    CAssertEq(client.state, kSyncpointActivating);
+
+    disposeOfClient(client);
+    resetLocalState(server);
+    [fakeServer release];
+    restoreAppDefaults();
+    [[NSFileManager defaultManager] removeItemAtPath: serverPath error: NULL];
+}
+
+#endif
@@ -0,0 +1,63 @@
+//
+//  SyncpointFakeServer.h
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+@class CouchServer, CouchDatabase;
+
+
+/** An in-process stand-in for a Syncpoint server, for testing and benchmarking the client
+    without a real server. It keeps the "remote" databases on a local CouchServer and plays the
+    server's part of the protocol:
+    - Session documents pushed to sp_handshake are given a user ID and a new control database,
+      and marked active.
+    - New channel documents in a control database are given a new cloud database (filled with
+      docsPerChannel documents) and marked ready. If makesSnapshots is set, a snapshot of the
+      cloud database is made first and its URL is added to the channel.
+    Point a SyncpointClient's remote server URL at the URL property. */
+@interface SyncpointFakeServer : NSObject
+{
+    CouchServer* _server;
+    CouchDatabase* _handshakeDB;
+    NSMutableArray* _controlDBs;
+    NSUInteger _docsPerChannel;
+    BOOL _makesSnapshots;
+    NSMutableArray* _snapshotJobs;
+    NSMutableArray* _snapshotPaths;
+    NSUInteger _lastID;
+}
+
+- (id) initWithServer: (CouchServer*)server;
+
+/** The URL to use as the client's remote server. */
+@property (readonly) NSURL* URL;
+
+/** A URL at which no server answers (connections to it are refused), to use as the remote server
+    of a client that should see the server as down. */
+@property (readonly) NSURL* failingURL;
+
+/** Setting this makes the server at failingURL come back: requests to it are answered (with a
+    404) instead of refused. It applies process-wide, and is cleared when the fake server goes. */
+@property BOOL failingURLRecovered;
+
+/** Number of requests answered at failingURL since it recovered. */
+@property (readonly) NSUInteger failingURLRequestCount;
+
+/** Number of documents to put in each new channel's cloud database. */
+@property NSUInteger docsPerChannel;
+
+/** If YES, new channels get a snapshot_url, pointing to a snapshot of the cloud database made by
+    pulling it into a scratch database and copying that database's file. Defaults to NO. */
+@property BOOL makesSnapshots;
+
+/** Updates up to 'count' channel documents (at most once each) in each control database, to simulate server-side churn. */
+- (void) churnControlDatabases: (NSUInteger)count;
+
+/** Deletes the control and cloud databases and snapshots created so far. */
+- (void) deleteDatabases;
+
+@end
@@ -0,0 +1,321 @@
+//
+//  SyncpointFakeServer.m
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import "SyncpointFakeServer.h"
+#import <Syncpoint/Syncpoint.h>
+#import <TouchDB/TDDatabase.h>
+
+
+#define kFailingHost @"127.0.0.1"
+#define kFailingPort 9      // the 'discard' port; nothing listens
+
+
+// Once the failingURL has 'recovered', this protocol answers the requests sent to it. (URL
+// protocols are registered process-wide, so this state is global.)
+static BOOL sFailingURLRecovered;
+static NSUInteger sFailingURLRequestCount;
+
+@interface SyncpointRecoveredURLProtocol : NSURLProtocol
+@end
+
+@implementation SyncpointRecoveredURLProtocol
+
++ (BOOL) canInitWithRequest: (NSURLRequest*)request {
+    NSURL* url = request.URL;
+    return sFailingURLRecovered && [url.host isEqualToString: kFailingHost]
+                                && url.port.intValue == kFailingPort;
+}
+
++ (NSURLRequest*) canonicalRequestForRequest: (NSURLRequest*)request {
+    return request;
+}
+
+- (void) startLoading {
+    @synchronized([self class]) {
+        ++sFailingURLRequestCount;
+    }
+    NSDictionary* headers = [NSDictionary dictionaryWithObject: @"application/json"
+                                                        forKey: @"Content-Type"];
+    NSHTTPURLResponse* response = [[[NSHTTPURLResponse alloc] initWithURL: self.request.URL
+                                                               statusCode: 404
+                                                              HTTPVersion: @"HTTP/1.1"
+                                                             headerFields: headers] autorelease];
+    NSData* body = [@"{\"error\":\"not_found\",\"reason\":\"missing\"}"
+                            dataUsingEncoding: NSUTF8StringEncoding];
+    [self.client URLProtocol: self didReceiveResponse: response
+          cacheStoragePolicy: NSURLCacheStorageNotAllowed];
+    [self.client URLProtocol: self didLoadData: body];
+    [self.client URLProtocolDidFinishLoading: self];
+}
+
+- (void) stopLoading {
+}
+
+@end
+
+
+@interface SyncpointFakeServer ()
+- (void) handshakeDocumentChanged: (CouchDocument*)doc;
+- (void) controlDocumentChanged: (CouchDocument*)doc;
+- (void) snapshotCloudDatabase: (CouchDatabase*)cloudDB forChannel: (CouchDocument*)doc;
+- (void) markChannel: (CouchDocument*)doc readyWithCloudDatabase: (CouchDatabase*)cloudDB
+         snapshotURL: (NSURL*)snapshotURL;
+@end
+
+
+@implementation SyncpointFakeServer
+
+
+@synthesize docsPerChannel=_docsPerChannel, makesSnapshots=_makesSnapshots;
+
+
+- (id) initWithServer: (CouchServer*)server {
+    self = [super init];
+    if (self) {
+        _server = [server retain];
+        _controlDBs = [[NSMutableArray alloc] init];
+        _snapshotJobs = [[NSMutableArray alloc] init];
+        _snapshotPaths = [[NSMutableArray alloc] init];
+        _handshakeDB = [[server databaseNamed: @"sp_handshake"] retain];
+        NSError* error;
+        if (![_handshakeDB ensureCreated: &error]) {
+            NSLog(@"SyncpointFakeServer: Couldn't create handshake db: %@", error);
+            [self release];
+            return nil;
+        }
+        __block SyncpointFakeServer* blockSelf = self;  // don't retain self
+        [_handshakeDB onChange: ^(CouchDocument* doc, BOOL externalChange) {
+            [blockSelf handshakeDocumentChanged: doc];
+        }];
+        _handshakeDB.tracksChanges = YES;
+    }
+    return self;
+}
+
+
+- (void) dealloc {
+    self.failingURLRecovered = NO;
+    for (NSDictionary* job in _snapshotJobs)
+        [[job objectForKey: @"pull"] removeObserver: self forKeyPath: @"running"];
+    [_snapshotJobs release];
+    [_snapshotPaths release];
+    [_handshakeDB release];
+    [_controlDBs release];
+    [_server release];
+    [super dealloc];
+}
+
+
+- (NSURL*) URL {
+    return _server.URL;
+}
+
+
+- (NSURL*) failingURL {
+    return [NSURL URLWithString: [NSString stringWithFormat: @"http://%@:%d/",
+                                                             kFailingHost, kFailingPort]];
+}
+
+
+- (BOOL) failingURLRecovered {
+    return sFailingURLRecovered;
+}
+
+- (void) setFailingURLRecovered: (BOOL)recovered {
+    static BOOL sRegistered;
+    if (recovered && !sRegistered) {
+        [NSURLProtocol registerClass: [SyncpointRecoveredURLProtocol class]];
+        sRegistered = YES;
+    }
+    if (recovered && !sFailingURLRecovered) {
+        @synchronized([SyncpointRecoveredURLProtocol class]) {
+            sFailingURLRequestCount = 0;
+        }
+    }
+    sFailingURLRecovered = recovered;
+}
+
+
+- (NSUInteger) failingURLRequestCount {
+    @synchronized([SyncpointRecoveredURLProtocol class]) {
+        return sFailingURLRequestCount;
+    }
+}
+
+
+- (NSString*) makeID: (NSString*)prefix {
+    return [NSString stringWithFormat: @"%@-%lu-%lu", prefix,
+                (unsigned long)getpid(), (unsigned long)++_lastID];
+}
+
+
+// Activates new session documents, like the server does.
+- (void) handshakeDocumentChanged: (CouchDocument*)doc {
+    NSDictionary* properties = doc.properties;
+    if (![[properties objectForKey: @"state"] isEqual: @"new"]
+            || ![properties objectForKey: @"oauth_creds"])
+        return;
+
+    NSString* userID = [self makeID: @"user"];
+    CouchDatabase* controlDB = [_server databaseNamed: [self makeID: @"control"]];
+    if (![controlDB ensureCreated: NULL])
+        return;
+    [_controlDBs addObject: controlDB];
+    __block SyncpointFakeServer* blockSelf = self;
+    [controlDB onChange: ^(CouchDocument* doc, BOOL externalChange) {
+        [blockSelf controlDocumentChanged: doc];
+    }];
+    controlDB.tracksChanges = YES;
+
+    NSMutableDictionary* newProperties = [[properties mutableCopy] autorelease];
+    [newProperties setObject: @"active" forKey: @"state"];
+    [newProperties setObject: userID forKey: @"user_id"];
+    [newProperties setObject: controlDB.relativePath forKey: @"control_database"];
+    [newProperties setObject: [NSDictionary dictionaryWithObjectsAndKeys:
+                                    userID, @"user_id",
+                                    controlDB.relativePath, @"control_database", nil]
+                      forKey: @"session"];
+    NSLog(@"SyncpointFakeServer: Activating session %@ with control db %@",
+          doc.documentID, controlDB.relativePath);
+    [[doc putProperties: newProperties] start];
+}
+
+
+// Provisions new channels, like the server does.
+- (void) controlDocumentChanged: (CouchDocument*)doc {
+    NSDictionary* properties = doc.properties;
+    if (![[properties objectForKey: @"type"] isEqual: @"channel"]
+            || ![[properties objectForKey: @"state"] isEqual: @"new"])
+        return;
+
+    CouchDatabase* cloudDB = [_server databaseNamed: [self makeID: @"cloud"]];
+    if (![cloudDB ensureCreated: NULL])
+        return;
+    if (_docsPerChannel > 0) {
+        NSMutableArray* docs = [NSMutableArray arrayWithCapacity: _docsPerChannel];
+        for (NSUInteger i = 0; i < _docsPerChannel; ++i) {
+            [docs addObject: [NSDictionary dictionaryWithObjectsAndKeys:
+                                [NSNumber numberWithUnsignedInteger: i], @"n",
+                                @"Lorem ipsum dolor sit amet, consectetur adipisicing elit", @"text",
+                                nil]];
+        }
+        [[cloudDB putChanges: docs] wait];
+    }
+
+    if (_makesSnapshots)
+        [self snapshotCloudDatabase: cloudDB forChannel: doc];
+    else
+        [self markChannel: doc readyWithCloudDatabase: cloudDB snapshotURL: nil];
+}
+
+
+- (void) markChannel: (CouchDocument*)doc readyWithCloudDatabase: (CouchDatabase*)cloudDB
+         snapshotURL: (NSURL*)snapshotURL
+{
+    NSMutableDictionary* newProperties = [[doc.properties mutableCopy] autorelease];
+    [newProperties setObject: @"ready" forKey: @"state"];
+    [newProperties setObject: cloudDB.relativePath forKey: @"cloud_database"];
+    if (snapshotURL)
+        [newProperties setObject: snapshotURL.absoluteString forKey: @"snapshot_url"];
+    [[doc putProperties: newProperties] start];
+}
+
+
+// Makes a snapshot the way a real server would: by pulling the cloud database, from the same
+// URL the client will use, into a scratch database, so the snapshot carries the checkpoint.
+- (void) snapshotCloudDatabase: (CouchDatabase*)cloudDB forChannel: (CouchDocument*)doc {
+    CouchDatabase* snapshotDB = [_server databaseNamed: [self makeID: @"snapshot"]];
+    if (![snapshotDB ensureCreated: NULL]) {
+        [self markChannel: doc readyWithCloudDatabase: cloudDB snapshotURL: nil];
+        return;
+    }
+    NSURL* cloudURL = [NSURL URLWithString: cloudDB.relativePath relativeToURL: self.URL];
+    CouchReplication* pull = [snapshotDB pullFromDatabaseAtURL: cloudURL];
+    [pull addObserver: self forKeyPath: @"running" options: 0 context: NULL];
+    [_snapshotJobs addObject: [NSDictionary dictionaryWithObjectsAndKeys:
+                                    pull, @"pull", doc, @"doc", cloudDB, @"cloudDB",
+                                    snapshotDB, @"snapshotDB", nil]];
+}
+
+
+- (void) observeValueForKeyPath: (NSString*)keyPath ofObject: (id)object
+                         change: (NSDictionary*)change context: (void*)context
+{
+    CouchReplication* pull = object;
+    if (pull.running)
+        return;
+    NSDictionary* job = nil;
+    for (NSDictionary* j in _snapshotJobs) {
+        if ([j objectForKey: @"pull"] == pull) {
+            job = [[j retain] autorelease];
+            break;
+        }
+    }
+    if (!job)
+        return;
+    [pull removeObserver: self forKeyPath: @"running"];
+    [_snapshotJobs removeObjectIdenticalTo: job];
+
+    CouchDocument* doc = [job objectForKey: @"doc"];
+    CouchDatabase* cloudDB = [job objectForKey: @"cloudDB"];
+    CouchDatabase* snapshotDB = [job objectForKey: @"snapshotDB"];
+    NSString* snapshotPath = [NSTemporaryDirectory() stringByAppendingPathComponent:
+                                [snapshotDB.relativePath stringByAppendingPathExtension: @"touchdb"]];
+    [_snapshotPaths addObject: snapshotPath];
+    [(CouchTouchDBServer*)_server tellTDDatabaseNamed: snapshotDB.relativePath
+                                                   to: ^(TDDatabase* tddb) {
+        NSFileManager* fmgr = [NSFileManager defaultManager];
+        [fmgr removeItemAtPath: snapshotPath error: NULL];
+        NSError* error;
+        BOOL copied = [fmgr copyItemAtPath: tddb.path toPath: snapshotPath error: &error];
+        if (!copied)
+            NSLog(@"SyncpointFakeServer: Couldn't copy snapshot: %@", error);
+        dispatch_async(dispatch_get_main_queue(), ^{
+            NSLog(@"SyncpointFakeServer: Made snapshot of %@", cloudDB.relativePath);
+            [self markChannel: doc readyWithCloudDatabase: cloudDB
+                  snapshotURL: (copied ? [NSURL fileURLWithPath: snapshotPath] : nil)];
+            [[snapshotDB DELETE] start];
+        });
+    }];
+}
+
+
+- (void) churnControlDatabases: (NSUInteger)count {
+    for (CouchDatabase* controlDB in _controlDBs) {
+        NSUInteger n = 0;
+        for (CouchQueryRow* row in [[controlDB getAllDocuments] rows]) {
+            NSDictionary* properties = row.document.properties;
+            if (![[properties objectForKey: @"type"] isEqual: @"channel"])
+                continue;
+            NSMutableDictionary* newProperties = [[properties mutableCopy] autorelease];
+            NSUInteger touched = [[properties objectForKey: @"touched"] unsignedIntegerValue];
+            [newProperties setObject: [NSNumber numberWithUnsignedInteger: touched + 1]
+                              forKey: @"touched"];
+            [[row.document putProperties: newProperties] start];
+            if (++n >= count)
+                break;
+        }
+    }
+}
+
+
+- (void) deleteDatabases {
+    for (CouchDatabase* db in _server.getDatabases) {
+        NSString* name = db.relativePath;
+        if ([name hasPrefix: @"control-"] || [name hasPrefix: @"cloud-"]
+                || [name hasPrefix: @"snapshot-"])
+            [[db DELETE] wait];
+    }
+    [_controlDBs removeAllObjects];
+    for (NSString* path in _snapshotPaths)
+        [[NSFileManager defaultManager] removeItemAtPath: path error: NULL];
+    [_snapshotPaths removeAllObjects];
+}
+
+
+@end
@@ -0,0 +1,18 @@
+//
+//  SyncpointTraceDecoder.h
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+
+/** Decodes a dump written by +[SyncpointTrace dumpToFile:error:] and prints it to stdout, either
+    as a human-readable timeline (times in milliseconds since the first event, with begin/end
+    pairs indented and annotated with their durations), or as JSON in the Chrome trace-event
+    format, which chrome://tracing can load.
+    Invoke by launching the Mac demo app with "--decode-trace <file>" or "--chrome-trace <file>".
+    @return  A process exit status. */
+int RunSyncpointTraceDecoder(NSString* path, BOOL chromeFormat);
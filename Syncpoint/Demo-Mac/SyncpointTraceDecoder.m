@@ -0,0 +1,85 @@
+//
+//  SyncpointTraceDecoder.m
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import "SyncpointTraceDecoder.h"
+#import <Syncpoint/SyncpointTrace.h>
+
+
+static const char* const kPhaseCodes = "iBE";     // Chrome's codes, indexed by SyncpointTracePhase
+
+
+static void printTimeline(const SyncpointTraceRecord* records, uint32_t count, double nsPerTick) {
+    uint64_t startTime = records[0].time;
+    // Stack of the begin records currently open, per thread, to indent by and time the ends:
+    const SyncpointTraceRecord* open[2][64];
+    unsigned depth[2] = {0, 0};
+    for (uint32_t i = 0; i < count; ++i) {
+        const SyncpointTraceRecord* r = &records[i];
+        unsigned thread = r->mainThread ? 0 : 1;
+        if (r->phase == kSyncpointTraceEnd && depth[thread] > 0)
+            --depth[thread];
+        printf("%12.3f  %-4s %*s%c %s(%u)",
+               (r->time - startTime) * nsPerTick / 1.0e6, (r->mainThread ? "main" : "bg"),
+               2 * depth[thread], "", kPhaseCodes[MIN(r->phase, 2)],
+               SyncpointTraceEventName(r->event), r->arg);
+        if (r->phase == kSyncpointTraceBegin) {
+            if (depth[thread] < 64)
+                open[thread][depth[thread]] = r;
+            ++depth[thread];
+        } else if (r->phase == kSyncpointTraceEnd && depth[thread] < 64) {
+            const SyncpointTraceRecord* begin = open[thread][depth[thread]];
+            if (begin->event == r->event)
+                printf("  [%.3f ms]", (r->time - begin->time) * nsPerTick / 1.0e6);
+        }
+        printf("\n");
+    }
+}
+
+
+static void printChromeTrace(const SyncpointTraceRecord* records, uint32_t count, double nsPerTick) {
+    uint64_t startTime = records[0].time;
+    printf("{\"traceEvents\": [\n");
+    for (uint32_t i = 0; i < count; ++i) {
+        const SyncpointTraceRecord* r = &records[i];
+        printf("  {\"name\": \"%s\", \"cat\": \"syncpoint\", \"ph\": \"%c\", \"ts\": %.3f, "
+               "\"pid\": 1, \"tid\": %d, %s\"args\": {\"arg\": %u}}%s\n",
+               SyncpointTraceEventName(r->event), kPhaseCodes[MIN(r->phase, 2)],
+               (r->time - startTime) * nsPerTick / 1.0e3, (r->mainThread ? 1 : 2),
+               (r->phase == kSyncpointTraceInstant ? "\"s\": \"t\", " : ""),
+               r->arg, (i + 1 < count ? "," : ""));
+    }
+    printf("]}\n");
+}
+
+
+int RunSyncpointTraceDecoder(NSString* path, BOOL chromeFormat) {
+    @autoreleasepool {
+        NSData* data = [NSData dataWithContentsOfFile: path];
+        if (!data) {
+            fprintf(stderr, "Can't read %s\n", path.fileSystemRepresentation);
+            return 1;
+        }
+        const SyncpointTraceFileHeader* header = data.bytes;
+        if (data.length < sizeof(*header) || memcmp(header->magic, "SPTR", 4) != 0
+                || header->version != 1 || header->recordSize != sizeof(SyncpointTraceRecord)
+                || data.length < sizeof(*header) + header->count * sizeof(SyncpointTraceRecord)) {
+            fprintf(stderr, "%s is not a Syncpoint trace dump (or is from another version)\n",
+                    path.fileSystemRepresentation);
+            return 1;
+        }
+        if (header->count == 0)
+            return 0;
+        const SyncpointTraceRecord* records = (const void*)(header + 1);
+        double nsPerTick = (double)header->timebaseNumer / header->timebaseDenom;
+        if (chromeFormat)
+            printChromeTrace(records, header->count, nsPerTick);
+        else
+            printTimeline(records, header->count, nsPerTick);
+        return 0;
+    }
+}
@@ -0,0 +1,56 @@
+//
+//  DemoWriteCoalescer.h
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+@class CouchDatabase, RESTOperation;
+
+
+/** Collects document edits made in quick succession and saves them together.
+    Edits to the same document within the window are merged into one new revision, and edits
+    that cancel out (like checking and then unchecking an item) produce no revision at all.
+    All the pending edits are committed in a single bulk write at the end of the window.
+    The revisions saved by each commit are remembered, so edits made before the caller's copy of
+    a document catches up still build on the latest revision; and a document that turns out to
+    have been changed elsewhere has its edits re-applied to its current revision. */
+@interface DemoWriteCoalescer : NSObject
+
+- (id) initWithDatabase: (CouchDatabase*)database;
+
+@property (readonly) CouchDatabase* database;
+
+/** How long, in seconds, to wait after the first edit before committing. Defaults to 0.5. */
+@property NSTimeInterval window;
+
+/** Called after each batch is committed, with the bulk-write operation. */
+@property (copy) void (^onCommit)(RESTOperation* op);
+
+/** Schedules a change to an existing document.
+    @param documentID  The document's ID.
+    @param properties  The document's current saved properties, including "_rev". Only used
+            by the first edit in a window, and only if they're at least as new as the last
+            revision this object saved; later edits build on the pending properties.
+    @param changes  The property values to set. */
+- (void) updateDocumentWithID: (NSString*)documentID
+               fromProperties: (NSDictionary*)properties
+                      changes: (NSDictionary*)changes;
+
+/** Schedules the creation of a new document. */
+- (void) createDocumentWithProperties: (NSDictionary*)properties;
+
+/** The properties the document will have once pending edits are committed, or nil if it has
+    no pending edits. */
+- (NSDictionary*) pendingPropertiesOfDocumentWithID: (NSString*)documentID;
+
+/** Commits all pending edits now. */
+- (RESTOperation*) flush;
+
+/** Commits all pending edits now, and calls onFlushed once they've been written, along with any
+    edits still waiting on an earlier commit or being re-applied after a conflict. */
+- (void) flushThen: (void (^)(void))onFlushed;
+
+@end
@@ -0,0 +1,207 @@
+//
+//  DemoWriteCoalescer.m
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import "DemoWriteCoalescer.h"
+#import <Syncpoint/CouchCocoa.h>
+
+
+@implementation DemoWriteCoalescer
+{
+    CouchDatabase* _database;
+    NSTimeInterval _window;
+    NSMutableDictionary* _savedProperties;      // doc ID -> properties at start of window
+    NSMutableDictionary* _pendingProperties;    // doc ID -> properties to save
+    NSMutableDictionary* _pendingChanges;       // doc ID -> changes made in this window
+    NSMutableDictionary* _committedProperties;  // doc ID -> properties saved by a recent flush
+    NSMutableArray* _pendingCreations;
+    NSMutableArray* _flushWaiters;              // blocks passed to -flushThen:
+    NSUInteger _retrying;                       // number of conflicting docs being re-fetched
+    BOOL _scheduled, _committing;
+    void (^_onCommit)(RESTOperation*);
+}
+
+
+@synthesize database=_database, window=_window, onCommit=_onCommit;
+
+
+- (id) initWithDatabase: (CouchDatabase*)database {
+    NSParameterAssert(database);
+    self = [super init];
+    if (self) {
+        _database = database;
+        _window = 0.5;
+        _savedProperties = [[NSMutableDictionary alloc] init];
+        _pendingProperties = [[NSMutableDictionary alloc] init];
+        _pendingChanges = [[NSMutableDictionary alloc] init];
+        _committedProperties = [[NSMutableDictionary alloc] init];
+        _pendingCreations = [[NSMutableArray alloc] init];
+        _flushWaiters = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+
+- (void) scheduleFlush {
+    if (!_scheduled) {
+        _scheduled = YES;
+        [self performSelector: @selector(flush) withObject: nil afterDelay: _window];
+    }
+}
+
+
+// The generation number of a revision ID, e.g. 3 for "3-deadbeef".
+static int generationOf(NSDictionary* properties) {
+    return [[properties objectForKey: @"_rev"] intValue];
+}
+
+
+- (void) updateDocumentWithID: (NSString*)documentID
+               fromProperties: (NSDictionary*)properties
+                      changes: (NSDictionary*)changes
+{
+    NSMutableDictionary* pending = [_pendingProperties objectForKey: documentID];
+    if (!pending) {
+        // The caller's properties may predate a revision saved by a recent flush (e.g. if they
+        // came from a query that hasn't been updated yet); if so, build on that revision instead.
+        NSDictionary* committed = [_committedProperties objectForKey: documentID];
+        if (committed && generationOf(committed) > generationOf(properties))
+            properties = committed;
+        else
+            [_committedProperties removeObjectForKey: documentID];
+        [_savedProperties setObject: [properties copy] forKey: documentID];
+        pending = [properties mutableCopy];
+        [_pendingProperties setObject: pending forKey: documentID];
+    }
+    [pending addEntriesFromDictionary: changes];
+    NSMutableDictionary* pendingChanges = [_pendingChanges objectForKey: documentID];
+    if (!pendingChanges) {
+        pendingChanges = [NSMutableDictionary dictionary];
+        [_pendingChanges setObject: pendingChanges forKey: documentID];
+    }
+    [pendingChanges addEntriesFromDictionary: changes];
+    [self scheduleFlush];
+}
+
+
+- (void) createDocumentWithProperties: (NSDictionary*)properties {
+    [_pendingCreations addObject: [properties copy]];
+    [self scheduleFlush];
+}
+
+
+- (NSDictionary*) pendingPropertiesOfDocumentWithID: (NSString*)documentID {
+    return [_pendingProperties objectForKey: documentID];
+}
+
+
+- (RESTOperation*) flush {
+    [NSObject cancelPreviousPerformRequestsWithTarget: self selector: @selector(flush) object: nil];
+    _scheduled = NO;
+    if (_committing) {
+        // Wait for the revisions saved by the previous flush, so these edits can build on them:
+        [self scheduleFlush];
+        return nil;
+    }
+
+    NSMutableArray* docs = [NSMutableArray arrayWithArray: _pendingCreations];
+    NSMutableDictionary* changesByID = [NSMutableDictionary dictionary];
+    for (NSString* documentID in _pendingProperties) {
+        NSDictionary* properties = [_pendingProperties objectForKey: documentID];
+        // Skip documents whose edits cancelled each other out:
+        if (![properties isEqual: [_savedProperties objectForKey: documentID]]) {
+            NSMutableDictionary* doc = [properties mutableCopy];
+            [doc setObject: documentID forKey: @"_id"];
+            [docs addObject: doc];
+            [changesByID setObject: [_pendingChanges objectForKey: documentID] forKey: documentID];
+        }
+    }
+    [_pendingCreations removeAllObjects];
+    [_pendingProperties removeAllObjects];
+    [_pendingChanges removeAllObjects];
+    [_savedProperties removeAllObjects];
+    if (docs.count == 0)
+        return nil;
+
+    _committing = YES;
+    RESTOperation* op = [_database putChanges: docs];
+    [op onCompletion: ^{
+        _committing = NO;
+        if (!op.error)
+            [self committed: docs results: op.responseBody.fromJSON changes: changesByID];
+        if (_onCommit)
+            _onCommit(op);
+        [self flushIfAwaited];
+    }];
+    [op start];
+    return op;
+}
+
+
+- (void) flushThen: (void (^)(void))onFlushed {
+    [_flushWaiters addObject: [onFlushed copy]];
+    [self flush];
+    [self notifyIfFlushed];
+}
+
+
+// If anyone's waiting in -flushThen:, commits edits that were held back without waiting for the
+// window to end, then checks whether everything's been written.
+- (void) flushIfAwaited {
+    if (_flushWaiters.count == 0)
+        return;
+    if (_scheduled)
+        [self flush];
+    [self notifyIfFlushed];
+}
+
+
+// Calls the -flushThen: blocks once there's nothing left to write.
+- (void) notifyIfFlushed {
+    if (_committing || _scheduled || _retrying > 0 || _flushWaiters.count == 0)
+        return;
+    NSArray* waiters = [_flushWaiters copy];
+    [_flushWaiters removeAllObjects];
+    for (void (^onFlushed)(void) in waiters)
+        onFlushed();
+}
+
+
+// Processes the per-document results of a bulk write: remembers the new revisions, and re-applies
+// the changes to documents that turned out to have been updated elsewhere.
+- (void) committed: (NSArray*)docs results: (NSArray*)results changes: (NSDictionary*)changesByID {
+    if (![results isKindOfClass: [NSArray class]] || results.count != docs.count)
+        return;
+    [results enumerateObjectsUsingBlock: ^(NSDictionary* result, NSUInteger i, BOOL *stop) {
+        NSString* documentID = [result objectForKey: @"id"];
+        NSDictionary* changes = [changesByID objectForKey: documentID];
+        if (!changes)
+            return;     // (a new document)
+        NSString* revID = [result objectForKey: @"rev"];
+        if (revID) {
+            NSMutableDictionary* properties = [[docs objectAtIndex: i] mutableCopy];
+            [properties removeObjectForKey: @"_id"];
+            [properties setObject: revID forKey: @"_rev"];
+            [_committedProperties setObject: properties forKey: documentID];
+        } else if ([[result objectForKey: @"error"] isEqual: @"conflict"]) {
+            // Retry against the document's current revision:
+            ++_retrying;
+            RESTOperation* get = [[_database documentWithID: documentID] GET];
+            [get onCompletion: ^{
+                --_retrying;
+                NSDictionary* current = get.error ? nil : get.responseBody.fromJSON;
+                if ([current isKindOfClass: [NSDictionary class]])
+                    [self updateDocumentWithID: documentID fromProperties: current changes: changes];
+                [self flushIfAwaited];
+            }];
+            [get start];
+        }
+    }];
+}
+
+
+@end
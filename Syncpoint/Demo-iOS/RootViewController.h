@@ -20,15 +20,17 @@
 
 #import <UIKit/UIKit.h>
 #import <Syncpoint/CouchUITableSource.h>
-@class CouchDatabase, CouchPersistentReplication, Syncpoint;
+@class CouchDatabase, Syncpoint, DemoWriteCoalescer;
 
 
 @interface RootViewController : UIViewController <CouchUITableDelegate, UITextFieldDelegate>
 {
     CouchDatabase *database;
     NSURL* remoteSyncURL;
-    CouchPersistentReplication* _pull;
-    CouchPersistentReplication* _push;
+    NSTimer* _syncTimer;
+    NSUInteger _syncBaseline;
+    BOOL _syncing;
+    DemoWriteCoalescer* _writes;
     
     UITableView *tableView;
     IBOutlet UIProgressView *progress;
@@ -21,9 +21,17 @@
 #import "RootViewController.h"
 #import "ConfigViewController.h"
 #import "DemoAppDelegate.h"
+#import "DemoWriteCoalescer.h"
 
 #import <Syncpoint/CouchCocoa.h>
 #import <Syncpoint/CouchDesignDocument_Embedded.h>
+#import <Syncpoint/Syncpoint.h>
+
+
+#define kSyncPollInterval 1.0
+
+// How many times to re-query and retry deleting checked items that had conflicts.
+#define kMaxDeleteRetries 2
 
 
 @interface RootViewController ()
@@ -90,8 +98,25 @@
 }
 
 
+- (void)viewWillDisappear:(BOOL)animated {
+    [super viewWillDisappear: animated];
+    [_writes flush];
+    // The timer retains us, so it mustn't outlive the view's time on screen:
+    [self forgetSync];
+}
+
+
 - (void)useDatabase:(CouchDatabase*)theDatabase {
     self.database = theDatabase;
+
+    // Edits are batched up and saved together, so rapid taps don't each make a revision:
+    _writes = [[DemoWriteCoalescer alloc] initWithDatabase: theDatabase];
+    __weak RootViewController* weakSelf = self;
+    _writes.onCommit = ^(RESTOperation* op) {
+        if (op.error)
+            [weakSelf showErrorAlert: @"Couldn't save changes" forOperation: op];
+        // No need to re-run the query; it's a live query and will notice the changes itself.
+    };
     
     // Create a 'view' containing list items sorted by date:
     CouchDesignDocument* design = [database designDocumentWithName: @"default"];
@@ -99,6 +124,15 @@
         id date = [doc objectForKey: @"created_at"];
         if (date) emit(date, doc);
     }) version: @"1.0"];
+
+    // and one indexing items by whether they're checked off, whose values are the revision IDs
+    // (which is all that's needed to delete them):
+    [design defineViewNamed: @"byCheck" mapBlock: MAPBLOCK({
+        if ([doc objectForKey: @"created_at"]) {
+            BOOL checked = [[doc objectForKey: @"check"] boolValue];
+            emit([NSNumber numberWithBool: checked], [doc objectForKey: @"_rev"]);
+        }
+    }) version: @"1.0"];
     
     // and a validation function requiring parseable dates:
     design.validationBlock = VALIDATIONBLOCK({
@@ -139,7 +173,8 @@
     // Configure the cell contents. Our view function (see above) copies the document properties
     // into its value, so we can read them from there without having to load the document.
     // cell.textLabel.text is already set, thanks to setting up labelProperty above.
-    NSDictionary* properties = row.value;
+    NSDictionary* properties = [_writes pendingPropertiesOfDocumentWithID: row.documentID]
+                                    ?: row.value;
     BOOL checked = [[properties objectForKey:@"check"] boolValue];
     cell.textLabel.textColor = checked ? [UIColor grayColor] : [UIColor blackColor];
     cell.imageView.image = [UIImage imageNamed:
@@ -157,60 +192,99 @@
 
 - (void)tableView:(UITableView *)tableView didSelectRowAtIndexPath:(NSIndexPath *)indexPath {
     CouchQueryRow *row = [self.dataSource rowAtIndex:indexPath.row];
-    CouchDocument *doc = [row document];
-
-    // Toggle the document's 'checked' property:
-    NSMutableDictionary *docContent = [doc.properties mutableCopy];
-    BOOL wasChecked = [[docContent valueForKey:@"check"] boolValue];
-    [docContent setObject:[NSNumber numberWithBool:!wasChecked] forKey:@"check"];
 
-    // Save changes, asynchronously:
-    RESTOperation* op = [doc putProperties:docContent];
-    [op onCompletion: ^{
-        if (op.error)
-            [self showErrorAlert: @"Failed to update item" forOperation: op];
-        // Re-run the query:
-		[self.dataSource.query start];
-    }];
-    [op start];
+    // Toggle the document's 'checked' property. The row's value is a copy of the document's
+    // properties (including its _rev), so there's no need to load the document:
+    NSDictionary* properties = [_writes pendingPropertiesOfDocumentWithID: row.documentID]
+                                    ?: row.value;
+    BOOL wasChecked = [[properties valueForKey:@"check"] boolValue];
+    [_writes updateDocumentWithID: row.documentID
+                   fromProperties: row.value
+                          changes: [NSDictionary dictionaryWithObject: [NSNumber numberWithBool:!wasChecked]
+                                                               forKey: @"check"]];
+
+    // Show the change right away, without waiting for it to be saved:
+    [tableView reloadRowsAtIndexPaths: [NSArray arrayWithObject: indexPath]
+                     withRowAnimation: UITableViewRowAnimationNone];
 }
 
 
 #pragma mark - Editing:
 
 
-- (NSArray*)checkedDocuments {
-    // If there were a whole lot of documents, this would be more efficient with a custom query.
-    NSMutableArray* checked = [NSMutableArray array];
-    for (CouchQueryRow* row in self.dataSource.rows) {
-        CouchDocument* doc = row.document;
-        if ([[doc.properties valueForKey:@"check"] boolValue])
-            [checked addObject: doc];
+- (NSArray*)checkedRows {
+    // Look up the checked items in the 'byCheck' view; this doesn't load any documents.
+    CouchQuery* query = [[database designDocumentWithName: @"default"] queryViewNamed: @"byCheck"];
+    query.keys = [NSArray arrayWithObject: [NSNumber numberWithBool: YES]];
+    return query.rows.allObjects;
+}
+
+
+- (void)deleteRows:(NSArray*)rows retries:(int)retries {
+    if (rows.count == 0)
+        return;
+    // Delete all the documents in one bulk write:
+    NSMutableArray* deletions = [NSMutableArray arrayWithCapacity: rows.count];
+    for (CouchQueryRow* row in rows) {
+        [deletions addObject: [NSDictionary dictionaryWithObjectsAndKeys:
+                                    row.documentID, @"_id",
+                                    row.value, @"_rev",
+                                    (id)kCFBooleanTrue, @"_deleted", nil]];
     }
-    return checked;
+    RESTOperation* op = [database putChanges: deletions];
+    [op onCompletion: ^{
+        if (op.error) {
+            [self showErrorAlert: @"Couldn't delete items" forOperation: op];
+            return;
+        }
+        // The bulk write succeeds even if individual deletions fail, so check each result.
+        // A conflict means the item was changed after it was queried; query again and retry.
+        NSUInteger conflicts = 0, failures = 0;
+        for (NSDictionary* result in op.responseBody.fromJSON) {
+            NSString* error = [result objectForKey: @"error"];
+            if ([error isEqualToString: @"conflict"])
+                ++conflicts;
+            else if (error)
+                ++failures;
+        }
+        if (conflicts > 0 && retries > 0) {
+            [self deleteRows: self.checkedRows retries: retries - 1];
+        } else if (conflicts + failures > 0) {
+            NSString* message = [NSString stringWithFormat: @"Couldn't delete %u of the items",
+                                                            (unsigned)(conflicts + failures)];
+            [self showErrorAlert: message forOperation: op];
+        }
+    }];
+    [op start];
 }
 
 
 - (IBAction)deleteCheckedItems:(id)sender {
-    NSUInteger numChecked = self.checkedDocuments.count;
-    if (numChecked == 0)
-        return;
-    NSString* message = [NSString stringWithFormat: @"Are you sure you want to remove the %u"
-                                                     " checked-off item%@?",
-                                                     numChecked, (numChecked==1 ? @"" : @"s")];
-    UIAlertView* alert = [[UIAlertView alloc] initWithTitle: @"Remove Completed Items?"
-                                                    message: message
-                                                   delegate: self
-                                          cancelButtonTitle: @"Cancel"
-                                          otherButtonTitles: @"Remove", nil];
-    [alert show];
+    // Wait till recent taps have been saved, or the query won't see them:
+    [_writes flushThen: ^{
+        NSUInteger numChecked = self.checkedRows.count;
+        if (numChecked == 0)
+            return;
+        NSString* message = [NSString stringWithFormat: @"Are you sure you want to remove the %u"
+                                                         " checked-off item%@?",
+                                                         numChecked, (numChecked==1 ? @"" : @"s")];
+        UIAlertView* alert = [[UIAlertView alloc] initWithTitle: @"Remove Completed Items?"
+                                                        message: message
+                                                       delegate: self
+                                              cancelButtonTitle: @"Cancel"
+                                              otherButtonTitles: @"Remove", nil];
+        [alert show];
+    }];
 }
 
 
 - (void)alertView:(UIAlertView *)alertView didDismissWithButtonIndex:(NSInteger)buttonIndex {
     if (buttonIndex == 0)
         return;
-    [dataSource deleteDocuments: self.checkedDocuments];
+    // Query again, since revisions may have changed while the alert was up:
+    [_writes flushThen: ^{
+        [self deleteRows: self.checkedRows retries: kMaxDeleteRetries];
+    }];
 }
 
 
@@ -252,16 +326,8 @@
                                 [RESTBody JSONObjectWithDate: [NSDate date]], @"created_at",
                                 nil];
 
-    // Save the document, asynchronously:
-    CouchDocument* doc = [database untitledDocument];
-    RESTOperation* op = [doc putProperties:inDocument];
-    [op onCompletion: ^{
-        if (op.error)
-            [self showErrorAlert: @"Couldn't save the new item" forOperation: op];
-        // Re-run the query:
-		[self.dataSource.query start];
-	}];
-    [op start];
+    // Save the document, along with any other pending edits:
+    [_writes createDocumentWithProperties: inDocument];
 }
 
 
@@ -274,25 +340,55 @@
 
 
 - (void) observeSync {
-    if (!self.database)
-        return;
-    [self forgetSync];
-    
-    NSArray* repls = self.database.replications;
-    if (repls.count < 2)
+    if (!self.database || _syncTimer)
         return;
-    _pull = [repls objectAtIndex: 0];
-    _push = [repls objectAtIndex: 1];
-    [_pull addObserver: self forKeyPath: @"completed" options: 0 context: NULL];
-    [_push addObserver: self forKeyPath: @"completed" options: 0 context: NULL];
+    _syncTimer = [NSTimer scheduledTimerWithTimeInterval: kSyncPollInterval
+                                                  target: self
+                                                selector: @selector(updateSyncProgress)
+                                                userInfo: nil
+                                                 repeats: YES];
+    [self updateSyncProgress];
 }
 
 
 - (void) forgetSync {
-    [_pull removeObserver: self forKeyPath: @"completed"];
-    _pull = nil;
-    [_push removeObserver: self forKeyPath: @"completed"];
-    _push = nil;
+    [_syncTimer invalidate];
+    _syncTimer = nil;
+}
+
+
+- (void) updateSyncProgress {
+    // Add up the metrics of the control database and of every local channel installation:
+    SyncpointClient* syncpoint =
+            [(DemoAppDelegate*)[[UIApplication sharedApplication] delegate] syncpoint];
+    NSMutableArray* allMetrics = [NSMutableArray array];
+    if (syncpoint.controlMetrics)
+        [allMetrics addObject: syncpoint.controlMetrics];
+    for (SyncpointInstallation* installation in syncpoint.session.allInstallations) {
+        SyncpointSyncMetrics* metrics = [syncpoint metricsForInstallation: installation];
+        if (metrics)
+            [allMetrics addObject: metrics];
+    }
+    NSUInteger lag = 0, transferred = 0;
+    for (SyncpointSyncMetrics* metrics in allMetrics) {
+        lag += metrics.lag;
+        transferred += metrics.docsTransferred;
+    }
+
+    // Progress is measured from the point the replications last fell behind:
+    if (lag > 0) {
+        if (!_syncing)
+            _syncBaseline = transferred;
+        _syncing = YES;
+        NSUInteger completed = transferred - _syncBaseline;
+        NSLog(@"SYNC progress: %lu / %lu",
+              (unsigned long)completed, (unsigned long)(completed + lag));
+        [self showSyncStatus];
+        [progress setProgress:(completed / (float)(completed + lag))];
+    } else {
+        _syncing = NO;
+        [self showSyncButton];
+    }
 }
 
 
@@ -325,21 +421,4 @@
 }
 
 
-- (void) observeValueForKeyPath:(NSString *)keyPath ofObject:(id)object 
-                         change:(NSDictionary *)change context:(void *)context
-{
-    if (object == _pull || object == _push) {
-        unsigned completed = _pull.completed + _push.completed;
-        unsigned total = _pull.total + _push.total;
-        NSLog(@"SYNC progress: %u / %u", completed, total);
-        if (total > 0 && completed < total) {
-            [self showSyncStatus];
-            [progress setProgress:(completed / (float)total)];
-        } else {
-            [self showSyncButton];
-        }
-    }
-}
-
-
 @end
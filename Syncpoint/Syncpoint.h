@@ -10,5 +10,8 @@
 
 #import <Syncpoint/SyncpointClient.h>
 #import <Syncpoint/SyncpointModels.h>
+#import <Syncpoint/SyncpointSyncMetrics.h>
+#import <Syncpoint/SyncpointConnectionHealth.h>
+#import <Syncpoint/SyncpointTrace.h>
 #import <Syncpoint/SyncpointAuthenticator.h>
 #import <Syncpoint/SyncpointFacebookAuth.h>
@@ -7,7 +7,8 @@
 //
 
 #import <Foundation/Foundation.h>
-@class SyncpointAuthenticator, CouchServer, SyncpointSession, SyncpointInstallation;
+@class SyncpointAuthenticator, CouchServer, SyncpointSession, SyncpointInstallation, SyncpointSyncMetrics,
+       SyncpointConnectionHealth;
 
 
 typedef enum {
@@ -20,6 +21,12 @@ typedef enum {
 } SyncpointState;
 
 
+typedef enum {
+    kSyncpointContinuousSync,   /**< Replicate continuously, pushing and pulling changes as they happen */
+    kSyncpointBurstSync         /**< Replicate in one-shot bursts, every burstInterval seconds */
+} SyncpointSyncMode;
+
+
 /** Syncpoint client-side controller: pairs with the server and tracks channels and subscriptions. */
 @interface SyncpointClient : NSObject
 
@@ -27,6 +34,7 @@ typedef enum {
     @param localServer  The application's local server object.
     @param remoteServer  The URL of the remote Syncpoint-enabled server.
     @param appId  The id used to relate the client code to the server storage.
+            Each app ID has its own session; several can share the local control database.
     @param error  If initialization fails, this parameter will be filled in with an error.
     @return  The Syncpoint instance, or nil on failure. */
 - (id) initWithLocalServer: (CouchServer*)localServer
@@ -42,6 +50,22 @@ typedef enum {
 /** Current state (see SyncpointState enum above). Observable. */
 @property (readonly, nonatomic) SyncpointState state;
 
+/** Total seconds the client has spent in the given state so far, including the current one. */
+- (NSTimeInterval) timeSpentInState: (SyncpointState)state;
+
+/** Seconds it took to first reach kSyncpointReady after initialization; 0 if not ready yet. */
+@property (readonly) NSTimeInterval timeToReady;
+
+/** Total seconds spent reconciling installations with control-database changes. */
+@property (readonly) NSTimeInterval reconcileTime;
+
+/** YES if the client launched ready, trusting the local control database, and caught up later. */
+@property (readonly) BOOL warmStarted;
+
+/** If YES, syncing with the control database starts as soon as the server assigns one, without
+    waiting for activation to finish. Defaults to NO; set it before calling -authenticate:. */
+@property BOOL pipelinesActivation;
+
 /** Begins the process of authentication and provisioning an app database. */
 - (void) authenticate: (SyncpointAuthenticator*)authenticator;
 
@@ -49,6 +73,86 @@ typedef enum {
 /** The session object, which manages channels and subscriptions. */
 @property (readonly) SyncpointSession* session;
 
+/** Maximum number of channels that can be catching up with the server at once; the others wait
+    their turn, in priority order. Defaults to 4. */
+@property NSUInteger maxConcurrentChannelSyncs;
+
+/** Sets a channel's sync priority; higher ones are brought up to date first. Defaults to 0. */
+- (void) setSyncPriority: (NSInteger)priority forChannelNamed: (NSString*)channelName;
+
+/** Sets how a channel's installation syncs. In burst mode it syncs in one shot every
+    burstInterval seconds, or sooner after burstChangeThreshold local changes, together with the
+    other burst-mode installations; this saves battery at the cost of latency.
+    The default is kSyncpointContinuousSync. It's saved on the installation, so it persists. */
+- (void) setSyncMode: (SyncpointSyncMode)mode forChannelNamed: (NSString*)channelName;
+
+/** The sync mode of a channel's installation. */
+- (SyncpointSyncMode) syncModeForChannelNamed: (NSString*)channelName;
+
+/** Seconds between bursts, which are aligned to multiples of it on the clock. Defaults to 15 min. */
+@property NSTimeInterval burstInterval;
+
+/** Number of local changes to a burst-mode installation that trigger an early burst.
+    Defaults to 50. */
+@property NSUInteger burstChangeThreshold;
+
+/** If YES, new installations of channels with a server-made snapshot download it as one file
+    instead of replicating document by document. Needs embedded TouchDB. Defaults to NO. */
+@property BOOL bootstrapsFromSnapshots;
+
+/** Filter function (e.g. "app/recent") used to pull a preview into lazy installations before
+    they're hydrated. Defaults to nil, meaning nothing is pulled until then. */
+@property (copy) NSString* hydrationPreviewFilter;
+
+/** Parameters to pass to the hydrationPreviewFilter. */
+@property (copy) NSDictionary* hydrationPreviewParams;
+
+/** How much of its channel an installation has downloaded, from 0.0 (lazy, not hydrated yet)
+    to 1.0 (caught up with the server). */
+- (float) hydrationProgressOfInstallation: (SyncpointInstallation*)installation;
+
+/** Sync statistics for the control database's replications. */
+@property (readonly) SyncpointSyncMetrics* controlMetrics;
+
+/** Sync statistics for an installation's replications, or nil if it isn't being synced. */
+- (SyncpointSyncMetrics*) metricsForInstallation: (SyncpointInstallation*)installation;
+
+/** All the sync statistics as JSON, for telemetry: "control" holds the control database's metrics,
+    "installations" maps each local database name to its installation's metrics, "connection" holds
+    the connectionHealth counters, "sync_modes" compares continuous and burst-mode installations,
+    and "shared_control_replications" counts reuses of another session's control replications. */
+- (NSDictionary*) metricsSnapshot;
+
+/** Tracks whether the server is reachable, for all the client's replications. While it isn't,
+    they're stopped and the server is probed with backoff. */
+@property (readonly) SyncpointConnectionHealth* connectionHealth;
+
+/** Number of redundant requests to start a channel's replications. (For diagnostics.) */
+@property (readonly) NSUInteger suppressedReplicationStarts;
+
+/** Longest time, in seconds, a control-database change waits to be processed; changes arriving
+    within it are handled as one batch. Defaults to 0.1. */
+@property NSTimeInterval changeLatency;
+
+/** Number of batches of control-database changes processed so far. */
+@property (readonly) NSUInteger changeBatchCount;
+
+/** Number of change notifications merged into an earlier one's batch. */
+@property (readonly) NSUInteger mergedChangeNotifications;
+
+/** Asynchronously stops syncing uninstalled channels, deletes the local databases Syncpoint made
+    for them, and compacts the control database. Also runs by itself; see compactionInterval. */
+- (void) reclaimStorage;
+
+/** Seconds between automatic compactions; defaults to one day, 0 disables. Set before ready. */
+@property NSTimeInterval compactionInterval;
+
+/** Report of the last reclamation pass (see SyncpointReclaimer), or nil if none yet. Observable. */
+@property (readonly, copy) NSDictionary* lastReclamationReport;
+
+/** Total bytes of disk space freed by storage reclamation since the client was created. */
+@property (readonly) UInt64 totalBytesReclaimed;
+
 /** Call this from your app delegate's -application:handleOpenURL: method.
     @return  YES if Syncpoint's authenticator handled the URL, else NO. */
 - (BOOL) handleOpenURL: (NSURL*)url;
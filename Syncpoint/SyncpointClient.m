@@ -10,16 +10,28 @@
 #import "SyncpointAuthenticator.h"
 #import "SyncpointModels.h"
 #import "SyncpointInternal.h"
+#import "SyncpointControlHub.h"
+#import "SyncpointConnectionHealth.h"
+#import "SyncpointReplications.h"
+#import "SyncpointReclaimer.h"
+#import "SyncpointSnapshotLoader.h"
+#import "SyncpointSyncMetrics.h"
+#import "SyncpointTrace.h"
 #import "CouchCocoa.h"
 #import "TDMisc.h"
 
 
-#define kLocalControlDatabaseName @"sp_control"
 #define kRemoteHandshakeDatabaseName @"sp_handshake"
 
+#define kDefaultCompactionInterval (24*60*60.0)
+
+#define kDefaultChangeLatency 0.1
+
 
 @interface SyncpointClient ()
 @property (readwrite, nonatomic) SyncpointState state;
+@property (nonatomic, strong) CouchReplication *controlPull, *controlPush;
+@property (readwrite, copy) NSDictionary* lastReclamationReport;
 @end
 
 
@@ -29,17 +41,59 @@
     NSURL* _remote;
     NSString* _appId;
     CouchServer* _server;
+    SyncpointControlHub* _controlHub;
     CouchDatabase* _localControlDatabase;
     SyncpointSession* _session;
     CouchReplication *_controlPull;
     CouchReplication *_controlPush;
+    SyncpointReplicationRegistry* _replications;
+    SyncpointReplicationPair* _controlReplications;
+    BOOL _controlReplicationsSuspended;
+    SyncpointConnectionHealth* _connectionHealth;
+    SyncpointSyncMetrics* _controlMetrics;
+    NSMutableDictionary* _channelPriorities;    // channel name -> NSNumber
+    NSMutableDictionary* _channelSyncModes;     // channel name -> NSNumber, till it's installed
     SyncpointAuthenticator* _authenticator;
-    BOOL _observingControlPull;
+    NSString* _observedControlPullKey;
+    NSArray* _handshakeReplications;            // kept running while pipelining activation
     SyncpointState _state;
+    CFAbsoluteTime _stateStartTime;
+    NSTimeInterval _stateDurations[kSyncpointReady + 1];
+    BOOL _pipelinesActivation;
+    CFAbsoluteTime _launchTime;
+    NSTimeInterval _timeToReady;
+    BOOL _warmStarted;
+    NSTimeInterval _reconcileTime;
+    NSMutableSet* _changedDocIDs;
+    BOOL _needsFullReconcile;
+    BOOL _syncedExistingInstallations;
+    SyncpointReclaimer* _reclaimer;
+    NSDictionary* _lastReclamationReport;
+    NSTimeInterval _compactionInterval;
+    BOOL _needsReclaim, _needsCompact;
+    NSMutableDictionary* _previewPulls;         // installation ID -> CouchPersistentReplication
+    NSString* _hydrationPreviewFilter;
+    NSDictionary* _hydrationPreviewParams;
+    BOOL _bootstrapsFromSnapshots;
+    NSMutableDictionary* _snapshotLoaders;      // installation ID -> SyncpointSnapshotLoader
+    NSMutableSet* _snapshotFailures;            // IDs of installations whose snapshot failed
+    NSTimeInterval _changeLatency;
+    NSUInteger _changeNotificationsInBatch;
+    NSUInteger _changeBatchCount, _mergedChangeNotifications;
 }
 
 
-@synthesize localServer=_server, state=_state, session=_session, appId=_appId;
+@synthesize localServer=_server, state=_state, session=_session, appId=_appId,
+            controlPull=_controlPull, controlPush=_controlPush, controlMetrics=_controlMetrics,
+            connectionHealth=_connectionHealth,
+            pipelinesActivation=_pipelinesActivation, timeToReady=_timeToReady,
+            warmStarted=_warmStarted, reconcileTime=_reconcileTime,
+            lastReclamationReport=_lastReclamationReport, compactionInterval=_compactionInterval,
+            hydrationPreviewFilter=_hydrationPreviewFilter,
+            hydrationPreviewParams=_hydrationPreviewParams,
+            bootstrapsFromSnapshots=_bootstrapsFromSnapshots,
+            changeLatency=_changeLatency, changeBatchCount=_changeBatchCount,
+            mergedChangeNotifications=_mergedChangeNotifications;
 
 
 - (id) initWithLocalServer: (CouchServer*)localServer
@@ -54,21 +108,38 @@
         _server = localServer;
         _remote = remoteServerURL;
         _appId = syncpointAppId;
-        // Create the control database on the first run of the app.
-        _localControlDatabase = [_server databaseNamed: kLocalControlDatabaseName];
-        if (![_localControlDatabase ensureCreated: outError])
+        _launchTime = _stateStartTime = CFAbsoluteTimeGetCurrent();
+        _replications = [[SyncpointReplicationRegistry alloc] init];
+        [self setUpConnectionHealth];
+        _controlMetrics = [[SyncpointSyncMetrics alloc] init];
+        _channelPriorities = [[NSMutableDictionary alloc] init];
+        _channelSyncModes = [[NSMutableDictionary alloc] init];
+        _compactionInterval = kDefaultCompactionInterval;
+        _changeLatency = kDefaultChangeLatency;
+        _previewPulls = [[NSMutableDictionary alloc] init];
+        _snapshotLoaders = [[NSMutableDictionary alloc] init];
+        _snapshotFailures = [[NSMutableSet alloc] init];
+        // The control database is shared with any other clients (sessions) in the process:
+        _controlHub = [SyncpointControlHub hubForServer: _server error: outError];
+        if (!_controlHub)
             return nil;
-        _localControlDatabase.tracksChanges = YES;
-        _session = [SyncpointSession sessionInDatabase: _localControlDatabase];
+        _localControlDatabase = _controlHub.database;
+        _reclaimer = [[SyncpointReclaimer alloc] initWithControlDatabase: _localControlDatabase
+                                                            replications: _replications];
+        _session = [SyncpointSession sessionInDatabase: _localControlDatabase appId: _appId];
 
         if (_session) {
-            if (_session.isActive) {
+            if (_session.isActive && _controlHub.checkpointIsCurrent) {
+                LogTo(Syncpoint, @"Session is active; warm start");
+                [self warmStart];
+                [self observeControlDatabase];
+            } else if (_session.isActive) {
                 LogTo(Syncpoint, @"Session is active");
                 [self connectToControlDB];
                 [self observeControlDatabase];
             } else if (nil != _session.error) {
                 LogTo(Syncpoint, @"Session has error: %@", _session.error.localizedDescription);
-                _state = kSyncpointHasError;
+                self.state = kSyncpointHasError;
                 [self activateSession];
             } else {
                 LogTo(Syncpoint, @"Session is not active");
@@ -76,7 +147,7 @@
             }
         } else {
             LogTo(Syncpoint, @"No session -- authentication needed");
-            _state = kSyncpointUnauthenticated;
+            self.state = kSyncpointUnauthenticated;
         }
     }
     return self;
@@ -84,9 +155,120 @@
 
 
 - (void)dealloc {
+    [NSObject cancelPreviousPerformRequestsWithTarget: self];
+    [_connectionHealth stop];
     _authenticator.syncpoint = nil;
     [self stopObservingControlPull];
     [[NSNotificationCenter defaultCenter] removeObserver: self];
+    if (_needsFullReconcile)
+        [_controlHub finishedFullPass];
+    [_controlHub removeChangeSet: _changedDocIDs];
+    if (_controlReplications)
+        [_controlHub releaseReplications: _controlReplications
+                               suspended: _controlReplicationsSuspended];
+}
+
+
+- (NSUInteger) suppressedReplicationStarts {
+    return _replications.redundantStartCount;
+}
+
+
+- (NSUInteger) maxConcurrentChannelSyncs {
+    return _replications.maxActive;
+}
+
+- (void) setMaxConcurrentChannelSyncs: (NSUInteger)maxConcurrentChannelSyncs {
+    _replications.maxActive = MAX(maxConcurrentChannelSyncs, 1u);
+}
+
+
+- (void) setSyncPriority: (NSInteger)priority forChannelNamed: (NSString*)channelName {
+    [_channelPriorities setObject: [NSNumber numberWithInteger: priority] forKey: channelName];
+    SyncpointInstallation* inst = [_session channelWithName: channelName].installation;
+    if (inst)
+        [_replications setPriority: priority forOwnerID: inst.document.documentID];
+}
+
+
+// The mode is kept on the installation document, so it survives relaunches; until the channel
+// is installed it's remembered here, and -syncInstallation: moves it to the installation.
+- (void) setSyncMode: (SyncpointSyncMode)mode forChannelNamed: (NSString*)channelName {
+    if (mode == [self syncModeForChannelNamed: channelName])
+        return;
+    SyncpointInstallation* inst = [_session channelWithName: channelName].installation;
+    if (!inst) {
+        [_channelSyncModes setObject: [NSNumber numberWithInt: mode] forKey: channelName];
+        return;
+    }
+    [_channelSyncModes removeObjectForKey: channelName];
+    NSError* error;
+    if (![inst setSyncsInBursts: (mode == kSyncpointBurstSync) error: &error])
+        Warn(@"SyncpointClient: couldn't save sync mode of %@: %@", inst, error);
+    // If it's syncing, restart it in the new mode:
+    if ([_replications pairWithOwnerID: inst.document.documentID])
+        [self syncInstallation: inst];
+}
+
+
+- (SyncpointSyncMode) syncModeForChannelNamed: (NSString*)channelName {
+    NSNumber* pending = [_channelSyncModes objectForKey: channelName];
+    if (pending)
+        return pending.intValue;
+    SyncpointInstallation* inst = [_session channelWithName: channelName].installation;
+    return inst.syncsInBursts ? kSyncpointBurstSync : kSyncpointContinuousSync;
+}
+
+
+- (NSTimeInterval) burstInterval {
+    return _replications.burstInterval;
+}
+
+- (void) setBurstInterval: (NSTimeInterval)burstInterval {
+    _replications.burstInterval = burstInterval;
+}
+
+
+- (NSUInteger) burstChangeThreshold {
+    return _replications.burstChangeThreshold;
+}
+
+- (void) setBurstChangeThreshold: (NSUInteger)burstChangeThreshold {
+    _replications.burstChangeThreshold = MAX(burstChangeThreshold, 1u);
+}
+
+
+- (SyncpointSyncMetrics*) metricsForInstallation: (SyncpointInstallation*)installation {
+    return [_replications pairWithOwnerID: installation.document.documentID].metrics;
+}
+
+
+- (NSDictionary*) metricsSnapshot {
+    NSMutableDictionary* installations = [NSMutableDictionary dictionary];
+    NSUInteger count[2] = {0, 0};
+    double wakeups[2] = {0, 0}, docs[2] = {0, 0};
+    for (SyncpointReplicationPair* pair in _replications.allPairs) {
+        [installations setObject: pair.metrics.snapshot forKey: pair.localDatabase.relativePath];
+        int mode = pair.bursts ? kSyncpointBurstSync : kSyncpointContinuousSync;
+        ++count[mode];
+        wakeups[mode] += pair.metrics.wakeupsPerHour;
+        docs[mode] += pair.metrics.docsPerHour;
+    }
+    NSMutableDictionary* syncModes = [NSMutableDictionary dictionary];
+    for (int mode = kSyncpointContinuousSync; mode <= kSyncpointBurstSync; ++mode) {
+        [syncModes setObject: $dict({@"installations", [NSNumber numberWithUnsignedInteger: count[mode]]},
+                                    {@"wakeups_per_hour", [NSNumber numberWithDouble: wakeups[mode]]},
+                                    {@"docs_per_hour", [NSNumber numberWithDouble: docs[mode]]})
+                      forKey: (mode == kSyncpointBurstSync ? @"burst" : @"continuous")];
+    }
+    return $dict({@"control", _controlMetrics.snapshot},
+                 {@"shared_control_replications",
+                     [NSNumber numberWithUnsignedInteger: _controlHub.sharedReplicationCount]},
+                 {@"connection", _connectionHealth.snapshot},
+                 {@"installations", installations},
+                 {@"sync_modes", syncModes},
+                 {@"bursts", [NSNumber numberWithUnsignedInteger: _replications.burstCount]},
+                 {@"state", [NSNumber numberWithInt: _state]});
 }
 
 
@@ -95,6 +277,26 @@
 }
 
 
+- (void) setState: (SyncpointState)state {
+    if (state == _state)
+        return;
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    _stateDurations[_state] += now - _stateStartTime;
+    LogTo(Syncpoint, @"State %d -> %d (after %.3f sec)", _state, state, now - _stateStartTime);
+    SyncpointTrace(kSyncpointTraceStateChange, state);
+    _stateStartTime = now;
+    _state = state;
+}
+
+
+- (NSTimeInterval) timeSpentInState: (SyncpointState)state {
+    NSTimeInterval time = _stateDurations[state];
+    if (state == _state)
+        time += CFAbsoluteTimeGetCurrent() - _stateStartTime;
+    return time;
+}
+
+
 #pragma mark - AUTHENTICATION:
 
 
@@ -148,6 +350,24 @@ authenticatedWithToken: (id)accessToken
 #pragma mark - CONTROL DATABASE & SYNC:
 
 
+- (void) setControlPull: (CouchReplication*)pull {
+    [_controlMetrics stopObservingReplication: _controlPull];
+    [_connectionHealth unwatchReplication: _controlPull];
+    _controlPull = pull;
+    [_controlMetrics observeReplication: pull];
+    [_connectionHealth watchReplication: pull];
+}
+
+- (void) setControlPush: (CouchReplication*)push {
+    [_controlMetrics stopObservingReplication: _controlPush];
+    [_connectionHealth unwatchReplication: _controlPush];
+    _controlPush = push;
+    [_controlMetrics observeReplication: push];
+    [_connectionHealth watchReplication: push];
+}
+
+
+
 - (CouchReplication*) pullControlDataFromDatabaseNamed: (NSString*)dbName {
     NSURL* url = [NSURL URLWithString: dbName relativeToURL: _remote];
     return [_localControlDatabase pullFromDatabaseAtURL: url];
@@ -158,6 +378,21 @@ authenticatedWithToken: (id)accessToken
     return [_localControlDatabase pushToDatabaseAtURL: url];
 }
 
+// Returns the continuous replications with the session's control database. These are shared with
+// the other sessions in the process that sync with the same one.
+- (SyncpointReplicationPair*) sharedControlReplications {
+    if (!_controlReplications) {
+        NSURL* url = [NSURL URLWithString: _session.control_database relativeToURL: _remote];
+        _controlReplications = [_controlHub replicationsWith: url forUserID: _session.user_id];
+    }
+    if (_controlReplicationsSuspended) {
+        // This session suspended them while the server was down:
+        _controlReplicationsSuspended = NO;
+        [_controlHub resumeReplications: _controlReplications];
+    }
+    return _controlReplications;
+}
+
 
 // Starts an async bidirectional sync of the _session in the _localControlDatabase.
 - (void) activateSession {
@@ -165,12 +400,7 @@ authenticatedWithToken: (id)accessToken
     Assert(!_session.isActive);
     [_session clearState: nil];
     self.state = kSyncpointActivating;
-    NSString* sessionID = _session.document.documentID;
-    [self pushControlDataToDatabaseNamed: kRemoteHandshakeDatabaseName];
-    _controlPull = [self pullControlDataFromDatabaseNamed: kRemoteHandshakeDatabaseName];
-    _controlPull.filter = @"_doc_ids";
-    _controlPull.filterParams = $dict({@"doc_ids", $sprintf(@"[\"%@\"]", sessionID)});
-    _controlPull.continuous = YES;
+    [self startHandshakeReplications];
     
     //    ok now we should listen to changes on the control db and stop replication 
     //    when we get our doc back in a finalized state
@@ -178,26 +408,85 @@ authenticatedWithToken: (id)accessToken
 }
 
 
+// Syncs the _session document with the server's handshake database.
+- (void) startHandshakeReplications {
+    NSString* sessionID = _session.document.documentID;
+    // Other sessions share the control database, so push only this session's document:
+    self.controlPush = [self pushControlDataToDatabaseNamed: kRemoteHandshakeDatabaseName];
+    _controlPush.filter = kControlPushFilterName;
+    _controlPush.filterParams = $dict({@"session_id", sessionID});
+    self.controlPull = [self pullControlDataFromDatabaseNamed: kRemoteHandshakeDatabaseName];
+    _controlPull.filter = @"_doc_ids";
+    _controlPull.filterParams = $dict({@"doc_ids", $sprintf(@"[\"%@\"]", sessionID)});
+    _controlPull.continuous = YES;
+}
+
+
+// Starts collecting the IDs of documents changed in the _localControlDatabase since the last
+// reconciliation; if those aren't known, the first reconciliation will be a full pass.
+// This isn't done till the client first reconciles, since the hub won't save a checkpoint while
+// any registered client has changes outstanding, and a client that never gets that far (e.g. one
+// that's unauthenticated) would hold it up for every other session.
+- (void) trackControlDatabaseChanges {
+    _changedDocIDs = [_controlHub addChangeSet: &_needsFullReconcile];
+}
+
+
 // Begins observing document changes in the _localControlDatabase.
 - (void) observeControlDatabase {
     Assert(_localControlDatabase);
     [[NSNotificationCenter defaultCenter] addObserver: self 
-                                             selector: @selector(controlDatabaseChanged)
+                                             selector: @selector(controlDatabaseChangeNotified)
                                                  name: kCouchDatabaseChangeNotification 
                                                object: _localControlDatabase];
 }
 
+// Coalesces change notifications: the first one in a window schedules -controlDatabaseChanged
+// to run after the latency budget, and any more that arrive before then are merged into it.
+// (The IDs of the changed documents are collected separately, in _changedDocIDs.)
+- (void) controlDatabaseChangeNotified {
+    if (_changeNotificationsInBatch++ == 0)
+        [self performSelector: @selector(deliverControlDatabaseChanges) withObject: nil
+                   afterDelay: _changeLatency];
+}
+
+- (void) deliverControlDatabaseChanges {
+    if (_changeNotificationsInBatch == 0)
+        return;
+    ++_changeBatchCount;
+    _mergedChangeNotifications += _changeNotificationsInBatch - 1;
+    LogTo(Syncpoint, @"Control DB change batch #%u (%u notifications)",
+          (unsigned)_changeBatchCount, (unsigned)_changeNotificationsInBatch);
+    SyncpointTraceBegin(kSyncpointTraceChangeBatch, (uint32_t)_changeNotificationsInBatch);
+    _changeNotificationsInBatch = 0;
+    [self controlDatabaseChanged];
+    SyncpointTraceEnd(kSyncpointTraceChangeBatch, 0);
+}
+
 - (void) controlDatabaseChanged {
     if (_state > kSyncpointActivating) {
         LogTo(Syncpoint, @"Control DB changed");
-        [self getUpToDateWithSubscriptions];
+        [self reconcileChanges];
         
-    } else if (_session.isActive) {
+    } else if (_session.isActive || (_pipelinesActivation && _session.control_database)) {
+        // (When pipelining, don't wait for the state change; the control database is enough.)
         LogTo(Syncpoint, @"Session is now active!");
-        [_controlPull stop];
-        _controlPull = nil;
-        [_controlPush stop];
-        _controlPush = nil;
+        if (_pipelinesActivation) {
+            // Carry the handshake replications across the transition instead of tearing them
+            // down first: they keep delivering the session document's updates until the
+            // control database has caught up, and are retired then.
+            NSMutableArray* handshake = [NSMutableArray arrayWithCapacity: 2];
+            if (_controlPull)
+                [handshake addObject: _controlPull];
+            if (_controlPush)
+                [handshake addObject: _controlPush];
+            _handshakeReplications = handshake;
+        } else {
+            [_controlPull stop];
+            [_controlPush stop];
+        }
+        self.controlPull = nil;
+        self.controlPush = nil;
         [self connectToControlDB];
     } else if (_state != kSyncpointHasError) {
         NSError* error = _session.error;
@@ -215,57 +504,223 @@ authenticatedWithToken: (id)accessToken
     LogTo(Syncpoint, @"Syncing with control database %@", controlDBName);
     Assert(controlDBName);
     
-    // During the initial sync, make the pull non-continuous, and observe when it stops.
-    // That way we know when the control DB has been fully updated from the server.
-    _controlPull = [self pullControlDataFromDatabaseNamed: controlDBName];
-    [_controlPull addObserver: self forKeyPath: @"running" options: 0 context: NULL];
-    _observingControlPull = YES;
+    SyncpointReplicationPair* shared = [self sharedControlReplications];
+    if (_pipelinesActivation) {
+        // Use the continuous pull from the start, and watch for it to go idle; that means the
+        // control DB has been fully updated, and saves setting up a second replication.
+        self.controlPull = shared.pull;
+        _observedControlPullKey = @"mode";
+    } else {
+        // During the initial sync, make the pull non-continuous, and observe when it stops.
+        // That way we know when the control DB has been fully updated from the server.
+        self.controlPull = [self pullControlDataFromDatabaseNamed: controlDBName];
+        _observedControlPullKey = @"running";
+    }
+    [_controlPull addObserver: self forKeyPath: _observedControlPullKey options: 0 context: NULL];
     
-    _controlPush = [self pushControlDataToDatabaseNamed: controlDBName];
-    _controlPush.continuous = YES;
+    self.controlPush = shared.push;
 
     self.state = kSyncpointUpdatingControlDatabase;
+    if (_pipelinesActivation) {
+        // Another session may already have the shared pull caught up (or failed), in which case
+        // it won't change mode:
+        [self observeValueForKeyPath: _observedControlPullKey ofObject: _controlPull
+                              change: nil context: NULL];
+    }
+}
+
+
+// Fast path for launching with an active session whose control database has been synced before:
+// trusts the local control state and goes straight to kSyncpointReady, then catches up with the
+// server in the background using a single continuous pull.
+- (void) warmStart {
+    NSString* controlDBName = _session.control_database;
+    LogTo(Syncpoint, @"Warm-starting with control database %@", controlDBName);
+    Assert(controlDBName);
+    SyncpointReplicationPair* shared = [self sharedControlReplications];
+    self.controlPull = shared.pull;
+    self.controlPush = shared.push;
+    _warmStarted = YES;
+    [self becomeReady];
+}
+
+
+- (void) becomeReady {
+    self.state = kSyncpointReady;
+    _timeToReady = CFAbsoluteTimeGetCurrent() - _launchTime;
+    LogTo(Syncpoint, @"**READY** (%s start, %.3f sec)", (_warmStarted ? "warm" : "cold"), _timeToReady);
+    // Process any changes made since the last launch, after the caller has had a chance to
+    // observe the state:
+    [self performSelector: @selector(reconcileChanges) withObject: nil afterDelay: 0.0];
+    // Then clean up anything left behind last time, and start periodic compaction:
+    _needsReclaim = YES;
+    [self scheduleCompaction];
 }
 
 
-// Observes when the initial _controlPull stops running, after -connectToControlDB.
+// Observes when the initial _controlPull stops running (or goes idle, if pipelining),
+// after -connectToControlDB.
 - (void) observeValueForKeyPath: (NSString*)keyPath ofObject: (id)object 
                          change: (NSDictionary*)change context: (void*)context
 {
-    if (object == _controlPull && !_controlPull.running) {
-        LogTo(Syncpoint, @"Up-to-date with control database");
+    if (object != _controlPull)
+        return;
+    // A continuous pull that goes offline or gets an error won't go idle, so treat that as the
+    // end of the initial sync too, and proceed with the local state:
+    CouchReplicationMode mode = _controlPull.mode;
+    BOOL failed = (mode == kCouchReplicationOffline || _controlPull.error != nil);
+    BOOL caughtUp = _controlPull.continuous ? (mode == kCouchReplicationIdle || failed)
+                                            : !_controlPull.running;
+    if (caughtUp) {
+        if (failed)
+            LogTo(Syncpoint, @"Couldn't update control database: %@", _controlPull.error);
+        else
+            LogTo(Syncpoint, @"Up-to-date with control database");
         [self stopObservingControlPull];
-        // Now start the pull up again, in continuous mode:
-        _controlPull = [self pullControlDataFromDatabaseNamed: _session.control_database];
-        _controlPull.continuous = YES;
-        self.state = kSyncpointReady;
-        LogTo(Syncpoint, @"**READY**");
-
-        [self getUpToDateWithSubscriptions];
+        [self retireHandshakeReplications];
+        if (!_controlPull.continuous) {
+            // Now switch to the shared continuous pull:
+            self.controlPull = [self sharedControlReplications].pull;
+        }
+        [self becomeReady];
     }
 }
 
 
+- (void) retireHandshakeReplications {
+    for (CouchReplication* repl in _handshakeReplications)
+        [repl stop];
+    _handshakeReplications = nil;
+}
+
+
 - (void) stopObservingControlPull {
-    if (_observingControlPull) {
-        [_controlPull removeObserver: self forKeyPath: @"running"];
-        _observingControlPull = NO;
+    if (_observedControlPullKey) {
+        [_controlPull removeObserver: self forKeyPath: _observedControlPullKey];
+        _observedControlPullKey = nil;
+    }
+}
+
+
+// Called when the control database changes or is initially pulled from the server.
+// Updates only the channels affected by documents changed since the last pass.
+// The checkpoint is only saved if every installation that was needed could be made, so that a
+// failed one is tried again (on the next pass, or else the next launch.)
+- (void) reconcileChanges {
+    if (!_changedDocIDs)
+        [self trackControlDatabaseChanges];
+    CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+    SyncpointTraceBegin(kSyncpointTraceReconcile, (uint32_t)_changedDocIDs.count);
+    NSUInteger channelsReconciled = 0;
+    BOOL ok;
+    if (_needsFullReconcile) {
+        [_changedDocIDs removeAllObjects];
+        ok = [self getUpToDateWithSubscriptions];
+        _needsFullReconcile = !ok;
+        if (ok)
+            [_controlHub finishedFullPass];
+    } else {
+        // The checkpoint only says which changes have been reconciled; the installations that
+        // already existed still need to be synced once per launch:
+        if (!_syncedExistingInstallations)
+            [self syncExistingInstallations];
+        ok = [self reconcileChangedDocs: &channelsReconciled];
+    }
+    if (ok)
+        [_controlHub saveCheckpoint];
+    _reconcileTime += CFAbsoluteTimeGetCurrent() - startTime;
+    SyncpointTraceEnd(kSyncpointTraceReconcile, (uint32_t)channelsReconciled);
+    if (_needsReclaim)
+        [self reclaimStorageAndCompact: NO];
+}
+
+
+// Handles the documents changed since the last pass, by reconciling the channels they belong to.
+// Channels that fail are left in _changedDocIDs (by their own doc ID) to be tried again.
+// On return, *outChannelCount is the number of channels reconciled.
+- (BOOL) reconcileChangedDocs: (NSUInteger*)outChannelCount {
+    *outChannelCount = 0;
+    if (_changedDocIDs.count == 0)
+        return YES;
+    NSMutableSet* channelIDs = [NSMutableSet set];
+    for (NSString* docID in _changedDocIDs) {
+        NSDictionary* properties = [_localControlDatabase documentWithID: docID].properties;
+        if (!properties) {
+            // Deleted; if it was an installation, stop syncing it and reclaim its database:
+            [_replications stopReplicationsWithOwnerID: docID];
+            [self stopPreviewOfInstallationWithID: docID];
+            [[_snapshotLoaders objectForKey: docID] cancel];
+            [_snapshotLoaders removeObjectForKey: docID];
+            _needsReclaim = YES;
+            continue;
+        }
+        NSString* type = [properties objectForKey: @"type"];
+        NSString* channelID;
+        if ([type isEqual: @"channel"])
+            channelID = docID;
+        else
+            channelID = $castIf(NSString, [properties objectForKey: @"channel_id"]);
+        if (channelID)
+            [channelIDs addObject: channelID];
+    }
+    [_changedDocIDs removeAllObjects];
+    LogTo(Syncpoint, @"Reconciling %u changed channels", (unsigned)channelIDs.count);
+    *outChannelCount = channelIDs.count;
+    BOOL ok = YES;
+    for (NSString* channelID in channelIDs) {
+        NSError* error;
+        if (![self reconcileChannelWithID: channelID error: &error]) {
+            Warn(@"SyncpointClient: couldn't reconcile channel %@: %@", channelID, error);
+            [_changedDocIDs addObject: channelID];
+            ok = NO;
+        }
+    }
+    return ok;
+}
+
+
+// Makes an installation for the channel if it's subscribed to but not installed, and syncs the
+// installation if the channel is ready. Returns NO if the installation couldn't be made.
+- (BOOL) reconcileChannelWithID: (NSString*)channelID error: (NSError**)outError {
+    SyncpointSubscription* sub = [_session subscriptionForChannelID: channelID];
+    SyncpointInstallation* inst = [_session installationForChannelID: channelID];
+    if (sub.isActive && !inst) {
+        LogTo(Syncpoint, @"Making installation db for %@", sub);
+        inst = [sub makeInstallationWithLocalDatabase: nil error: outError];
+        if (!inst)
+            return NO;
     }
+    if ([inst.state isEqual: @"created"] && inst.channel.isReady)
+        [self syncInstallation: inst];
+    return YES;
 }
 
 
-// Called when the control database changes or is initial pulled from the server.
-- (void) getUpToDateWithSubscriptions {
+// Does a full pass over all subscriptions and installations. Returns NO if any installation
+// couldn't be made.
+- (BOOL) getUpToDateWithSubscriptions {
     // Make installations for any subscriptions that don't have one:
+    BOOL ok = YES;
     NSSet* installedSubscriptions = _session.installedSubscriptions;
     for (SyncpointSubscription* sub in _session.activeSubscriptions) {
         if (![installedSubscriptions containsObject: sub]) {
             LogTo(Syncpoint, @"Making installation db for %@", sub);
-            [sub makeInstallationWithLocalDatabase: nil error: nil];    // TODO: Report error
+            NSError* error;
+            if (![sub makeInstallationWithLocalDatabase: nil error: &error]) {
+                Warn(@"SyncpointClient: couldn't make installation for %@: %@", sub, error);
+                ok = NO;
+            }
         }
 
     }
-    // Sync all installations whose channels are ready:
+    [self syncExistingInstallations];
+    return ok;
+}
+
+
+// Syncs all installations whose channels are ready.
+- (void) syncExistingInstallations {
+    _syncedExistingInstallations = YES;
     for (SyncpointInstallation* inst in _session.allInstallations)
         if (inst.channel.isReady)
             [self syncInstallation: inst];
@@ -273,14 +728,232 @@ authenticatedWithToken: (id)accessToken
 
 
 // Starts bidirectional sync of an application database with its server counterpart.
+// (If the installation is lazy, only the preview is pulled.)
 - (void) syncInstallation: (SyncpointInstallation*)installation {
+    if (installation.isLazy) {
+        [self startPreviewOfInstallation: installation];
+        return;
+    }
+    [self stopPreviewOfInstallationWithID: installation.document.documentID];
+    if ([_snapshotLoaders objectForKey: installation.document.documentID])
+        return;     // Replication will start when the snapshot is installed
     CouchDatabase *localChannelDb = installation.localDatabase;
+    NSString* snapshotPath = installation.channel.snapshot_url;
+    if (_bootstrapsFromSnapshots && snapshotPath
+            && ![_snapshotFailures containsObject: installation.document.documentID]
+            && localChannelDb.getDocumentCount == 0) {
+        [self bootstrapInstallation: installation
+                       fromSnapshot: [NSURL URLWithString: snapshotPath relativeToURL: _remote]];
+        return;
+    }
     NSURL *cloudChannelURL = [NSURL URLWithString: installation.channel.cloud_database
                                     relativeToURL: _remote];
     LogTo(Syncpoint, @"Syncing local db '%@' with remote %@", localChannelDb, cloudChannelURL);
-    NSArray* repls = [localChannelDb replicateWithURL: cloudChannelURL exclusively: NO];
-    for (CouchPersistentReplication* repl in repls)
-        repl.continuous = YES;
+    NSInteger priority = [[_channelPriorities objectForKey: installation.channel.name] integerValue];
+    NSNumber* pendingMode = [_channelSyncModes objectForKey: installation.channel.name];
+    if (pendingMode) {
+        // The mode was set before the channel was installed; record it on the installation:
+        [_channelSyncModes removeObjectForKey: installation.channel.name];
+        NSError* error;
+        if (![installation setSyncsInBursts: (pendingMode.intValue == kSyncpointBurstSync)
+                                      error: &error])
+            Warn(@"SyncpointClient: couldn't save sync mode of %@: %@", installation, error);
+    }
+    [_replications startReplicationOf: localChannelDb
+                                 with: cloudChannelURL
+                              ownerID: installation.document.documentID
+                             priority: priority
+                               bursts: installation.syncsInBursts];
+}
+
+
+// Installs a snapshot of the channel as the installation's (empty) local database, then starts
+// replication, which picks up from the snapshot's checkpoint. If the snapshot fails, the
+// replication starts anyway, from scratch.
+- (void) bootstrapInstallation: (SyncpointInstallation*)installation
+                  fromSnapshot: (NSURL*)snapshotURL
+{
+    NSString* installationID = installation.document.documentID;
+    SyncpointSnapshotLoader* loader = [[SyncpointSnapshotLoader alloc]
+                                            initWithSnapshotURL: snapshotURL
+                                                  localDatabase: installation.localDatabase];
+    [_snapshotLoaders setObject: loader forKey: installationID];
+    __weak SyncpointClient* weakSelf = self;
+    __weak SyncpointSnapshotLoader* weakLoader = loader;
+    [loader start: ^(NSError* error) {
+        SyncpointClient* strongSelf = weakSelf;
+        if (!strongSelf || [strongSelf->_snapshotLoaders objectForKey: installationID] != weakLoader)
+            return;
+        [strongSelf->_snapshotLoaders removeObjectForKey: installationID];
+        if (![strongSelf->_localControlDatabase documentWithID: installationID].properties) {
+            LogTo(Syncpoint, @"Installation %@ was deleted during its snapshot bootstrap", installationID);
+            return;
+        }
+        if (error)
+            [strongSelf->_snapshotFailures addObject: installationID];
+        LogTo(Syncpoint, @"Snapshot bootstrap of %@ %@", installation, (error ? @"failed" : @"done"));
+        [strongSelf syncInstallation: installation];
+    }];
+}
+
+
+#pragma mark - LAZY HYDRATION:
+
+
+// Starts a one-shot pull of the documents that pass the hydrationPreviewFilter into a lazy
+// installation's database, if there's a filter.
+- (void) startPreviewOfInstallation: (SyncpointInstallation*)installation {
+    NSString* installationID = installation.document.documentID;
+    if (!_hydrationPreviewFilter || [_previewPulls objectForKey: installationID])
+        return;
+    NSURL *cloudChannelURL = [NSURL URLWithString: installation.channel.cloud_database
+                                    relativeToURL: _remote];
+    LogTo(Syncpoint, @"Pulling preview of %@ from %@ with filter %@",
+          installation, cloudChannelURL, _hydrationPreviewFilter);
+    CouchPersistentReplication* pull =
+            [installation.localDatabase pullFromDatabaseAtURL: cloudChannelURL];
+    pull.filter = _hydrationPreviewFilter;
+    pull.filterParams = _hydrationPreviewParams;
+    [_previewPulls setObject: pull forKey: installationID];
+}
+
+
+- (void) stopPreviewOfInstallationWithID: (NSString*)installationID {
+    CouchPersistentReplication* pull = [_previewPulls objectForKey: installationID];
+    if (pull) {
+        [pull deleteDocument];
+        [_previewPulls removeObjectForKey: installationID];
+    }
+}
+
+
+- (float) hydrationProgressOfInstallation: (SyncpointInstallation*)installation {
+    if (installation.isLazy)
+        return 0.0;
+    SyncpointReplicationPair* pair = [_replications pairWithOwnerID: installation.document.documentID];
+    if (pair.caughtUp)
+        return 1.0;
+    CouchPersistentReplication* pull = pair.pull;
+    if (pull.total == 0)
+        return 0.0;
+    return MIN(pull.completed / (float)pull.total, 1.0f);
+}
+
+
+#pragma mark - CONNECTION HEALTH:
+
+
+// Routes the failures of all replications to a single connection-health manager, which decides
+// when to stop them all and when to bring them back.
+- (void) setUpConnectionHealth {
+    _connectionHealth = [[SyncpointConnectionHealth alloc] initWithServerURL: _remote];
+    __weak SyncpointClient* weakSelf = self;
+    __weak SyncpointConnectionHealth* weakHealth = _connectionHealth;
+    _connectionHealth.onServerLost = ^(SyncpointConnectionHealth* health) {
+        [weakSelf suspendReplications];
+    };
+    _connectionHealth.onServerRegained = ^(SyncpointConnectionHealth* health) {
+        [weakSelf resumeReplications];
+    };
+    _replications.onFailure = ^(SyncpointReplicationPair* pair) {
+        [weakHealth reportFailure];
+    };
+}
+
+
+// Stops all replications with the server while it's unreachable, instead of letting each of
+// them keep retrying; the connection-health manager probes the server in their place.
+- (void) suspendReplications {
+    LogTo(Syncpoint, @"Server is unreachable; suspending replications");
+    SyncpointTrace(kSyncpointTraceServerLost, 0);
+    [_replications suspend];
+    [self stopObservingControlPull];
+    [self retireHandshakeReplications];
+    if (_controlReplications) {
+        // Other sessions may share these, so the hub only stops them once they've all given up.
+        if (!_controlReplicationsSuspended) {
+            _controlReplicationsSuspended = YES;
+            [_controlHub suspendReplications: _controlReplications];
+        }
+    } else {
+        [_controlPull stop];
+        [_controlPush stop];
+    }
+    self.controlPull = nil;
+    self.controlPush = nil;
+}
+
+
+// Restarts the replications once the server is back: the control database first, then the
+// channels, staggered in priority order.
+- (void) resumeReplications {
+    LogTo(Syncpoint, @"Server is reachable; resuming replications");
+    SyncpointTrace(kSyncpointTraceServerRegained, 0);
+    if (_state == kSyncpointActivating) {
+        [self startHandshakeReplications];
+    } else if (_state == kSyncpointUpdatingControlDatabase) {
+        [self connectToControlDB];
+    } else if (_state == kSyncpointReady) {
+        SyncpointReplicationPair* shared = [self sharedControlReplications];
+        self.controlPull = shared.pull;
+        self.controlPush = shared.push;
+    }
+    [_replications resumeWithStagger: _connectionHealth.reconnectStagger];
+}
+
+
+#pragma mark - STORAGE RECLAMATION:
+
+
+- (void) reclaimStorage {
+    [self reclaimStorageAndCompact: YES];
+}
+
+
+- (void) reclaimStorageAndCompact: (BOOL)compact {
+    _needsReclaim = YES;
+    _needsCompact = _needsCompact || compact;
+    if (_reclaimer.reclaiming || !_session.isActive)
+        return;     // will run when the current pass finishes, or once there's a session
+    _needsReclaim = NO;
+    compact = _needsCompact;
+    _needsCompact = NO;
+
+    NSMutableSet* liveOwners = [NSMutableSet set];
+    for (SyncpointInstallation* inst in _session.allInstallations)
+        [liveOwners addObject: inst.document.documentID];
+    SyncpointSession* session = _session;
+    __weak SyncpointClient* weakSelf = self;
+    [_reclaimer reclaimKeepingDatabases: ^{ return session.localDatabaseNames; }
+                                 owners: liveOwners
+                                compact: compact
+                             onComplete: ^(NSDictionary* report) {
+        SyncpointClient* strongSelf = weakSelf;
+        if (!strongSelf)
+            return;
+        strongSelf.lastReclamationReport = report;
+        if (strongSelf->_needsReclaim)
+            [strongSelf reclaimStorageAndCompact: NO];
+    }];
+}
+
+
+- (UInt64) totalBytesReclaimed {
+    return _reclaimer.totalBytesReclaimed;
+}
+
+
+// Compacts the control database every _compactionInterval seconds while the client exists.
+- (void) scheduleCompaction {
+    if (_compactionInterval <= 0)
+        return;
+    __weak SyncpointClient* weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(_compactionInterval * NSEC_PER_SEC)),
+                   dispatch_get_main_queue(), ^{
+        SyncpointClient* strongSelf = weakSelf;
+        [strongSelf reclaimStorage];
+        [strongSelf scheduleCompaction];
+    });
 }
 
 
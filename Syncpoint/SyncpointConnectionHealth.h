@@ -0,0 +1,81 @@
+//
+//  SyncpointConnectionHealth.h
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+@class SyncpointConnectionHealth;
+
+
+typedef void (^SyncpointConnectionHealthBlock)(SyncpointConnectionHealth* health);
+
+
+/** Decides, on behalf of all of a SyncpointClient's replications, whether the remote server is
+    reachable, so that they don't each retry on their own.
+    When a replication fails, the server is probed once (failures reported while a probe is in
+    progress share it.) If the probe fails too, the server is considered down: onServerLost is
+    called, so the replications can be stopped, and the server is re-probed with exponential
+    backoff and random jitter until it answers. Then onServerRegained is called, so the
+    replications can be restarted (staggered, in priority order.) A probe that succeeds right
+    away means the failure was specific to that replication, and nothing else happens. */
+@interface SyncpointConnectionHealth : NSObject
+
+- (id) initWithServerURL: (NSURL*)serverURL;
+
+@property (readonly) NSURL* serverURL;
+
+/** Called when the server has been found to be unreachable. */
+@property (copy) SyncpointConnectionHealthBlock onServerLost;
+
+/** Called when the server can be reached again after being lost. */
+@property (copy) SyncpointConnectionHealthBlock onServerRegained;
+
+/** Starts/stops watching a replication (a CouchReplication or CouchPersistentReplication) for
+    errors and going offline; either one counts as a failure. */
+- (void) watchReplication: (id)replication;
+- (void) unwatchReplication: (id)replication;
+
+/** Reports that something using the server failed. */
+- (void) reportFailure;
+
+/** Stops probing the server and watching replications, for good. */
+- (void) stop;
+
+/** Is the server believed to be reachable? */
+@property (readonly) BOOL serverReachable;
+
+/** Delay before the first retry, in seconds. Doubles with each failed retry. Defaults to 2. */
+@property NSTimeInterval initialRetryDelay;
+
+/** Upper limit of the retry delay, in seconds. Defaults to 300. */
+@property NSTimeInterval maxRetryDelay;
+
+/** Fraction of each retry delay that's randomized, from 0 to 1, so that clients that lost the
+    server at the same moment don't all come back at once. Defaults to 0.5. */
+@property double jitter;
+
+/** Delay between restarting successive replications once the server is back. Defaults to 0.25. */
+@property NSTimeInterval reconnectStagger;
+
+/** Number of failures reported (including by watched replications.) */
+@property (readonly) NSUInteger failureCount;
+
+/** Number of probes sent to the server. */
+@property (readonly) NSUInteger probeCount;
+
+/** Number of probes made while the server was lost, i.e. retries after backing off. */
+@property (readonly) NSUInteger retryCount;
+
+/** Number of times the server has been lost. */
+@property (readonly) NSUInteger outageCount;
+
+/** The delay before the next retry, if the server is lost; else 0. */
+@property (readonly) NSTimeInterval currentRetryDelay;
+
+/** The values of all the above counters, as a JSON-compatible dictionary. */
+@property (readonly) NSDictionary* snapshot;
+
+@end
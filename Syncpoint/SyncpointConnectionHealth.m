@@ -0,0 +1,201 @@
+//
+//  SyncpointConnectionHealth.m
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import "SyncpointConnectionHealth.h"
+#import "CouchCocoa.h"
+
+
+#define kDefaultInitialRetryDelay 2.0
+#define kDefaultMaxRetryDelay (5*60.0)
+#define kDefaultJitter 0.5
+#define kDefaultReconnectStagger 0.25
+
+
+// The delay before retry number 'attempt' (starting at 0): exponential backoff, capped, with the
+// given fraction of it randomized. 'random' is a number from 0 to 1.
+static NSTimeInterval retryDelay(NSUInteger attempt, NSTimeInterval initial, NSTimeInterval max,
+                                 double jitter, double random)
+{
+    NSTimeInterval delay = MIN(initial * pow(2.0, MIN(attempt, 30u)), max);
+    return delay * (1.0 - jitter * random);
+}
+
+
+static BOOL replicationFailed(id replication) {
+    return [replication mode] == kCouchReplicationOffline || [replication error] != nil;
+}
+
+
+@implementation SyncpointConnectionHealth
+{
+    NSURL* _serverURL;
+    SyncpointConnectionHealthBlock _onServerLost, _onServerRegained;
+    NSMutableArray* _watched;
+    BOOL _serverReachable, _probing, _stopped;
+    NSTimeInterval _initialRetryDelay, _maxRetryDelay, _reconnectStagger;
+    double _jitter;
+    NSUInteger _attempt;
+    NSTimeInterval _currentRetryDelay;
+    NSUInteger _failureCount, _probeCount, _retryCount, _outageCount;
+}
+
+
+@synthesize serverURL=_serverURL, onServerLost=_onServerLost, onServerRegained=_onServerRegained,
+            serverReachable=_serverReachable, initialRetryDelay=_initialRetryDelay,
+            maxRetryDelay=_maxRetryDelay, jitter=_jitter, reconnectStagger=_reconnectStagger,
+            failureCount=_failureCount, probeCount=_probeCount, retryCount=_retryCount,
+            outageCount=_outageCount, currentRetryDelay=_currentRetryDelay;
+
+
+- (id) initWithServerURL: (NSURL*)serverURL {
+    self = [super init];
+    if (self) {
+        _serverURL = serverURL;
+        _watched = [[NSMutableArray alloc] init];
+        _serverReachable = YES;
+        _initialRetryDelay = kDefaultInitialRetryDelay;
+        _maxRetryDelay = kDefaultMaxRetryDelay;
+        _jitter = kDefaultJitter;
+        _reconnectStagger = kDefaultReconnectStagger;
+    }
+    return self;
+}
+
+
+- (void) dealloc {
+    [self stop];
+}
+
+
+- (void) stop {
+    _stopped = YES;
+    [NSObject cancelPreviousPerformRequestsWithTarget: self selector: @selector(probe) object: nil];
+    for (id replication in _watched) {
+        [replication removeObserver: self forKeyPath: @"mode"];
+        [replication removeObserver: self forKeyPath: @"error"];
+    }
+    [_watched removeAllObjects];
+}
+
+
+- (void) watchReplication: (id)replication {
+    if (!replication || _stopped || [_watched indexOfObjectIdenticalTo: replication] != NSNotFound)
+        return;
+    [_watched addObject: replication];
+    [replication addObserver: self forKeyPath: @"mode" options: 0 context: NULL];
+    [replication addObserver: self forKeyPath: @"error" options: 0 context: NULL];
+}
+
+
+- (void) unwatchReplication: (id)replication {
+    if (!replication || [_watched indexOfObjectIdenticalTo: replication] == NSNotFound)
+        return;
+    [replication removeObserver: self forKeyPath: @"mode"];
+    [replication removeObserver: self forKeyPath: @"error"];
+    [_watched removeObjectIdenticalTo: replication];
+}
+
+
+- (void) observeValueForKeyPath: (NSString*)keyPath ofObject: (id)object
+                         change: (NSDictionary*)change context: (void*)context
+{
+    if (replicationFailed(object))
+        [self reportFailure];
+}
+
+
+- (void) reportFailure {
+    ++_failureCount;
+    if (_serverReachable && !_probing && !_stopped)
+        [self probe];
+    // Otherwise a probe is already in progress or scheduled, and will cover this failure.
+}
+
+
+// Checks whether the server is reachable by sending it a single request.
+- (void) probe {
+    _probing = YES;
+    ++_probeCount;
+    if (!_serverReachable)
+        ++_retryCount;
+    LogTo(Syncpoint, @"Probing server %@ (probe #%u)", _serverURL, (unsigned)_probeCount);
+    NSURLRequest* request = [NSURLRequest requestWithURL: _serverURL
+                                             cachePolicy: NSURLRequestReloadIgnoringCacheData
+                                         timeoutInterval: 30.0];
+    [NSURLConnection sendAsynchronousRequest: request
+                                       queue: [NSOperationQueue mainQueue]
+                           completionHandler: ^(NSURLResponse* response, NSData* data, NSError* error)
+    {
+        NSInteger status = [$castIf(NSHTTPURLResponse, response) statusCode];
+        [self probeFinished: (status > 0 && status < 500)];
+    }];
+}
+
+
+- (void) probeFinished: (BOOL)reachable {
+    _probing = NO;
+    if (_stopped)
+        return;
+    if (reachable) {
+        _attempt = 0;
+        _currentRetryDelay = 0;
+        if (!_serverReachable) {
+            LogTo(Syncpoint, @"Server %@ is reachable again", _serverURL);
+            _serverReachable = YES;
+            if (_onServerRegained)
+                _onServerRegained(self);
+        }
+        return;
+    }
+    if (_serverReachable) {
+        LogTo(Syncpoint, @"Server %@ is unreachable", _serverURL);
+        _serverReachable = NO;
+        ++_outageCount;
+        if (_onServerLost)
+            _onServerLost(self);
+    }
+    _currentRetryDelay = retryDelay(_attempt++, _initialRetryDelay, _maxRetryDelay, _jitter,
+                                    (double)arc4random() / UINT32_MAX);
+    LogTo(Syncpoint, @"Will retry server %@ in %.1f sec", _serverURL, _currentRetryDelay);
+    _probing = YES;     // (the scheduled probe counts as one in progress)
+    [self performSelector: @selector(probe) withObject: nil afterDelay: _currentRetryDelay];
+}
+
+
+- (NSDictionary*) snapshot {
+    return $dict({@"reachable", [NSNumber numberWithBool: _serverReachable]},
+                 {@"failures", [NSNumber numberWithUnsignedInteger: _failureCount]},
+                 {@"probes", [NSNumber numberWithUnsignedInteger: _probeCount]},
+                 {@"retries", [NSNumber numberWithUnsignedInteger: _retryCount]},
+                 {@"outages", [NSNumber numberWithUnsignedInteger: _outageCount]},
+                 {@"retry_delay", [NSNumber numberWithDouble: _currentRetryDelay]});
+}
+
+
+@end
+
+
+
+
+#pragma mark - TESTS:
+#if DEBUG
+
+TestCase(SyncpointConnectionBackoff) {
+    // Without jitter, the delay doubles up to the limit:
+    CAssertEq(retryDelay(0, 2.0, 300.0, 0.0, 0.7), 2.0);
+    CAssertEq(retryDelay(1, 2.0, 300.0, 0.0, 0.7), 4.0);
+    CAssertEq(retryDelay(4, 2.0, 300.0, 0.0, 0.7), 32.0);
+    CAssertEq(retryDelay(10, 2.0, 300.0, 0.0, 0.7), 300.0);
+    CAssertEq(retryDelay(1000, 2.0, 300.0, 0.0, 0.7), 300.0);
+    // Jitter takes off up to that fraction of the delay:
+    CAssertEq(retryDelay(3, 2.0, 300.0, 0.5, 0.0), 16.0);
+    CAssertEq(retryDelay(3, 2.0, 300.0, 0.5, 1.0), 8.0);
+    CAssertEq(retryDelay(3, 2.0, 300.0, 0.5, 0.5), 12.0);
+}
+
+#endif
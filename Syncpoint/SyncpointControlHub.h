@@ -0,0 +1,73 @@
+//
+//  SyncpointControlHub.h
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+@class CouchServer, CouchDatabase, SyncpointReplicationPair;
+
+
+/** The local control database, shared by all the SyncpointClients in the process that use the
+    same local server, one per session. The hub tracks the database's changes once on behalf of
+    all of them, and runs a single pair of continuous replications with each remote control
+    database and user, no matter how many sessions sync with it. */
+@interface SyncpointControlHub : NSObject
+
+/** Returns the hub of a local server, creating it (and the control database) if necessary.
+    The hub lives as long as some client retains it. */
++ (SyncpointControlHub*) hubForServer: (CouchServer*)server error: (NSError**)outError;
+
+/** The local control database. */
+@property (readonly) CouchDatabase* database;
+
+/** YES if change tracking resumed from a checkpoint saved by an earlier launch, and no changes
+    have arrived since. Only then can a client that registers now skip the full pass (warm start.)
+    This is checked per client, since the hub outlives the client that created it. */
+@property (readonly) BOOL checkpointIsCurrent;
+
+/** Registers a client's interest in changes to the database. A client should do this only once
+    it starts reconciling, since checkpoints wait for every registered client to catch up.
+    @param outNeedsFullPass  On return, YES if the client has to do a full pass over the database,
+            because the changes since its last reconciliation aren't known; in that case it must
+            call -finishedFullPass when it's done.
+    @return  A set that the IDs of changed documents will be added to. The client removes them as
+            it processes them. */
+- (NSMutableSet*) addChangeSet: (BOOL*)outNeedsFullPass;
+
+/** Unregisters a set returned by -addChangeSet:. */
+- (void) removeChangeSet: (NSMutableSet*)changeSet;
+
+/** Tells the hub that a full pass requested by -addChangeSet: is complete. */
+- (void) finishedFullPass;
+
+/** Saves the database's current sequence as the point to resume tracking changes from on the
+    next launch, provided every client has processed all the changes so far. */
+- (void) saveCheckpoint;
+
+/** Returns the continuous replications between the control database and a remote control
+    database for a user, starting them if no other session of that user has yet. The push only
+    sends that user's documents, since sessions of other accounts share the local database. */
+- (SyncpointReplicationPair*) replicationsWith: (NSURL*)remoteURL forUserID: (NSString*)userID;
+
+/** Tells the hub that a client has stopped using a pair returned by -replicationsWith:forUserID:
+    because the server is unreachable. The pair is only stopped once every client sharing it has
+    suspended it, since the others may still be able to reach the server. */
+- (void) suspendReplications: (SyncpointReplicationPair*)pair;
+
+/** Undoes a -suspendReplications: call, restarting the pair if it was stopped. */
+- (void) resumeReplications: (SyncpointReplicationPair*)pair;
+
+/** Tells the hub that a client is done with a pair returned by -replicationsWith:forUserID:,
+    dropping its suspension if it had one. */
+- (void) releaseReplications: (SyncpointReplicationPair*)pair suspended: (BOOL)suspended;
+
+/** The number of replication pairs currently shared by the hub's clients. */
+@property (readonly) NSUInteger replicationCount;
+
+/** The number of requests for replications that were served by already-running ones. */
+@property (readonly) NSUInteger sharedReplicationCount;
+
+@end
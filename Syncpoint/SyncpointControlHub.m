@@ -0,0 +1,218 @@
+//
+//  SyncpointControlHub.m
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import "SyncpointControlHub.h"
+#import "SyncpointReplications.h"
+#import "SyncpointInternal.h"
+#import "CouchCocoa.h"
+
+
+#define kLocalControlDatabaseName @"sp_control"
+
+// NSUserDefaults key for the last control-database sequence reconciled with the installations.
+#define kLastSequenceKey @"Syncpoint_ControlSequence"
+
+
+// Live hubs, keyed by server URL. The values aren't retained; a hub removes itself on dealloc.
+static NSMutableDictionary* sHubs;
+
+
+// Control replications, whose push only sends the documents of one user (the local database also
+// holds other accounts' sessions.) The filter is reapplied whenever the replications restart.
+@interface SyncpointControlReplicationPair : SyncpointReplicationPair
+@property (copy) NSString* userID;
+@end
+
+@implementation SyncpointControlReplicationPair
+
+@synthesize userID=_userID;
+
+- (void) startReplications {
+    [super startReplications];
+    self.push.filter = kControlPushFilterName;
+    self.push.filterParams = $dict({@"user_id", _userID});
+}
+
+@end
+
+
+@implementation SyncpointControlHub
+{
+    NSString* _key;
+    CouchDatabase* _database;
+    NSMutableArray* _changeSets;
+    BOOL _hadCheckpoint, _changesSeen;
+    NSUInteger _fullPassesPending;
+    NSMutableDictionary* _replications;         // [remote URL string, user ID] -> SyncpointReplicationPair
+    NSCountedSet* _replicationClients;          // pair -> number of clients using it
+    NSCountedSet* _suspendedReplications;       // pair -> number of clients that suspended it
+    NSUInteger _sharedReplicationCount;
+}
+
+
+@synthesize database=_database, sharedReplicationCount=_sharedReplicationCount;
+
+
++ (SyncpointControlHub*) hubForServer: (CouchServer*)server error: (NSError**)outError {
+    NSString* key = server.URL.absoluteString;
+    SyncpointControlHub* hub = [[sHubs objectForKey: key] nonretainedObjectValue];
+    if (!hub) {
+        hub = [[self alloc] initWithServer: server key: key error: outError];
+        if (!hub)
+            return nil;
+        if (!sHubs)
+            sHubs = [[NSMutableDictionary alloc] init];
+        [sHubs setObject: [NSValue valueWithNonretainedObject: hub] forKey: key];
+    }
+    return hub;
+}
+
+
+- (id) initWithServer: (CouchServer*)server key: (NSString*)key error: (NSError**)outError {
+    self = [super init];
+    if (self) {
+        _key = [key copy];
+        // Create the control database on the first run of the app.
+        _database = [server databaseNamed: kLocalControlDatabaseName];
+        if (![_database ensureCreated: outError])
+            return nil;
+        _changeSets = [[NSMutableArray alloc] init];
+        _replications = [[NSMutableDictionary alloc] init];
+        _replicationClients = [[NSCountedSet alloc] init];
+        _suspendedReplications = [[NSCountedSet alloc] init];
+
+        // Start tracking changes, resuming from the last sequence that every client reconciled:
+        NSNumber* lastSequence = [[NSUserDefaults standardUserDefaults] objectForKey: kLastSequenceKey];
+        if (lastSequence) {
+            _database.lastSequenceNumber = lastSequence.unsignedIntegerValue;
+            _hadCheckpoint = YES;
+        }
+        __weak SyncpointControlHub* weakSelf = self;
+        [_database onChange: ^(CouchDocument* doc, BOOL externalChange) {
+            [weakSelf documentChanged: doc.documentID];
+        }];
+        _database.tracksChanges = YES;
+    }
+    return self;
+}
+
+
+- (void) dealloc {
+    [sHubs removeObjectForKey: _key];
+}
+
+
+- (void) documentChanged: (NSString*)docID {
+    _changesSeen = YES;
+    for (NSMutableSet* changeSet in _changeSets)
+        [changeSet addObject: docID];
+}
+
+
+- (BOOL) checkpointIsCurrent {
+    return _hadCheckpoint && !_changesSeen;
+}
+
+
+- (NSMutableSet*) addChangeSet: (BOOL*)outNeedsFullPass {
+    // A client that shows up after changes have been delivered missed them, so it has to look
+    // at everything; so does every client if there was no checkpoint to resume from.
+    BOOL needsFullPass = !self.checkpointIsCurrent;
+    if (needsFullPass)
+        ++_fullPassesPending;
+    *outNeedsFullPass = needsFullPass;
+    NSMutableSet* changeSet = [[NSMutableSet alloc] init];
+    [_changeSets addObject: changeSet];
+    return changeSet;
+}
+
+
+- (void) removeChangeSet: (NSMutableSet*)changeSet {
+    [_changeSets removeObjectIdenticalTo: changeSet];
+}
+
+
+- (void) finishedFullPass {
+    Assert(_fullPassesPending > 0);
+    --_fullPassesPending;
+}
+
+
+- (void) saveCheckpoint {
+    if (_fullPassesPending > 0)
+        return;
+    for (NSMutableSet* changeSet in _changeSets)
+        if (changeSet.count > 0)
+            return;
+    NSUserDefaults* defaults = [NSUserDefaults standardUserDefaults];
+    [defaults setObject: [NSNumber numberWithUnsignedInteger: _database.lastSequenceNumber]
+                 forKey: kLastSequenceKey];
+}
+
+
+- (SyncpointReplicationPair*) replicationsWith: (NSURL*)remoteURL forUserID: (NSString*)userID {
+    // Sessions of different users can't share a pair, since the push is filtered by user:
+    NSArray* key = $array(remoteURL.absoluteString, userID ?: @"");
+    SyncpointReplicationPair* pair = [_replications objectForKey: key];
+    if (pair) {
+        ++_sharedReplicationCount;
+        [_replicationClients addObject: pair];
+        [pair start];   // in case every other client had suspended it
+        return pair;
+    }
+    LogTo(Syncpoint, @"Starting shared control replications with %@ for user %@", remoteURL, userID);
+    SyncpointControlReplicationPair* controlPair =
+            [[SyncpointControlReplicationPair alloc] initWithLocalDatabase: _database
+                                                                 remoteURL: remoteURL];
+    controlPair.userID = userID;
+    [controlPair start];
+    pair = controlPair;
+    [_replications setObject: pair forKey: key];
+    [_replicationClients addObject: pair];
+    return pair;
+}
+
+
+// Stops a pair if every client still using it has suspended it.
+- (void) stopReplicationsIfAllSuspended: (SyncpointReplicationPair*)pair {
+    NSUInteger clients = [_replicationClients countForObject: pair];
+    if (clients > 0 && [_suspendedReplications countForObject: pair] >= clients) {
+        LogTo(Syncpoint, @"All clients suspended shared control replications; stopping them");
+        [pair stop];
+    }
+}
+
+
+- (void) suspendReplications: (SyncpointReplicationPair*)pair {
+    Assert([_replicationClients containsObject: pair]);
+    [_suspendedReplications addObject: pair];
+    [self stopReplicationsIfAllSuspended: pair];
+}
+
+
+- (void) resumeReplications: (SyncpointReplicationPair*)pair {
+    Assert([_suspendedReplications containsObject: pair]);
+    [_suspendedReplications removeObject: pair];
+    [pair start];
+}
+
+
+- (void) releaseReplications: (SyncpointReplicationPair*)pair suspended: (BOOL)suspended {
+    if (suspended)
+        [_suspendedReplications removeObject: pair];
+    [_replicationClients removeObject: pair];
+    [self stopReplicationsIfAllSuspended: pair];
+}
+
+
+- (NSUInteger) replicationCount {
+    return _replications.count;
+}
+
+
+@end
@@ -10,16 +10,30 @@
 #import "SyncpointModels.h"
 
 
+/** Prefix of the names of the local channel databases that Syncpoint creates itself. */
+#define kLocalChannelDatabasePrefix @"channel-"
+
+/** Filter that passes the control documents belonging to one session or user. Its parameters are
+    "session_id" (passes that session document) and/or "user_id" (passes the session documents
+    and channels, subscriptions and installations made by that local user.) */
+#define kControlPushFilterName @"syncpoint/owned"
+
+
 @interface SyncpointModel ()
 @property NSString* state;
+
+/** The session whose object graph this model belongs to; set when the session indexes it. */
+@property (weak) SyncpointSession* owningSession;
 @end
 
 
 
 @interface SyncpointSession ()
 
-/** Returns the existing SyncpointSession in the local control database. */
-+ (SyncpointSession*) sessionInDatabase: (CouchDatabase*)database;
+/** Returns the existing SyncpointSession of an app in the local control database.
+    Several apps or accounts can have sessions in the same control database; each one's channels,
+    subscriptions and installations are tagged with its app ID. */
++ (SyncpointSession*) sessionInDatabase: (CouchDatabase*)database appId: (NSString*)appId;
 
 /** Creates a new session document in the local control database.
     @param database  The local server's control database.
@@ -37,22 +51,43 @@
 
 @property (readwrite) NSDictionary* oauth_creds;
 
+/** The ID of the app this session belongs to. */
+@property (readonly) NSString* app_id;
+
 /** The name of the remote database that the local control database syncs with. */
 @property (readonly) NSString* control_database;
 
 - (BOOL) clearState: (NSError**)outError;
 
+/** Adds a model to the session's cached object graph, e.g. right after it's been created. */
+- (void) addToGraph: (SyncpointModel*)model;
+
+/** Fast lookups in the cached object graph. */
+- (SyncpointSubscription*) subscriptionForChannelID: (NSString*)channelID;
+- (SyncpointInstallation*) installationForChannelID: (NSString*)channelID;
+
+/** The names of all local databases referred to by installations in the control database,
+    including ones whose installation documents are still being saved. */
+@property (readonly) NSSet* localDatabaseNames;
+
 @end
 
 
 
 @interface SyncpointChannel ()
 
+- (SyncpointInstallation*) makeInstallationWithLocalDatabase: (CouchDatabase*)localDatabase
+                                                      lazily: (BOOL)lazily
+                                                       error: (NSError**)error;
+
 @property (readwrite) NSString* name;
 
 /** The name of the server-side database to sync subscriptions with. */
 @property (readonly) NSString* cloud_database;
 
+/** The URL (relative to the server) of a snapshot of the cloud database, if the server has made one. */
+@property (readonly) NSString* snapshot_url;
+
 @end
 
 
@@ -61,6 +96,10 @@
 
 @property (readwrite) SyncpointChannel* channel;
 
+- (SyncpointInstallation*) makeInstallationWithLocalDatabase: (CouchDatabase*)localDatabase
+                                                      lazily: (BOOL)lazily
+                                                       error: (NSError**)error;
+
 @end
 
 
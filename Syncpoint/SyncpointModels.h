@@ -47,6 +47,30 @@
                                     toDatabase: (CouchDatabase*)localDatabase
                                          error: (NSError**)error;
 
+/** Like -installChannelNamed:toDatabase:error:, but optionally installs the channel lazily.
+    A lazy installation is registered with the server, but the channel's contents aren't downloaded until the app calls -hydrate on the installation. (SyncpointClient can optionally pull a filtered preview in the meantime; see its hydrationPreviewFilter property.) */
+- (SyncpointInstallation*) installChannelNamed: (NSString*)channelName
+                                    toDatabase: (CouchDatabase*)localDatabase
+                                        lazily: (BOOL)lazily
+                                         error: (NSError**)error;
+
+/** Asynchronous, batched version of -installChannelNamed:toDatabase:error:.
+    Creates whichever channel, subscription and installation documents are missing, and saves them all in a single bulk write without blocking the calling thread. Once the operation completes, the installation can be reached via -channelWithName:.
+    If the session isn't active yet, the request is queued (as with the synchronous method) and nil is returned.
+    @param channelName  The channel name. If a channel with this name doesn't exist, it will be created.
+    @param localDatabase  The database on the local server to sync the channel database with, or nil to have a new randomly-named database created.
+    @return  The bulk-write operation, or nil if there was nothing to do. It starts by itself once the local databases have been created. Installations whose database or related documents couldn't be created are deleted again afterwards. */
+- (RESTOperation*) beginInstallingChannelNamed: (NSString*)channelName
+                                    toDatabase: (CouchDatabase*)localDatabase;
+
+/** Installs any number of channels at once, with a single bulk write. Works like -beginInstallingChannelNamed:toDatabase:.
+    @param databasesByChannelName  Maps channel names to the local databases to sync them with; use NSNull instead of a database to have a new randomly-named one created. */
+- (RESTOperation*) beginInstallingChannels: (NSDictionary*)databasesByChannelName;
+
+/** Same as -beginInstallingChannels:, but the channels whose names are in lazyChannelNames are installed lazily (see -installChannelNamed:toDatabase:lazily:error:). */
+- (RESTOperation*) beginInstallingChannels: (NSDictionary*)databasesByChannelName
+                                    lazily: (NSSet*)lazyChannelNames;
+
 /** Enumerates all channels of this session that are in the "ready" state. */
 @property (readonly) NSEnumerator* readyChannels;
 
@@ -117,6 +141,7 @@
 - (SyncpointInstallation*) makeInstallationWithLocalDatabase: (CouchDatabase*)localDatabase
                                                        error: (NSError**)error;
 
+/** Deletes this subscription and its local installation, if any. */
 - (BOOL) unsubscribe: (NSError**)outError;
 
 @end
@@ -129,9 +154,26 @@
 /** Is this installation specific to this device? */
 @property (readonly) bool isLocal;
 
-/** The local database to sync. */
+/** The local database to sync. If the installation is lazy, it holds at most a preview until the
+    installation is hydrated. */
 @property (readonly) CouchDatabase* localDatabase;
 
+/** Is this a lazy installation whose channel contents haven't been downloaded yet? */
+@property (readonly) bool isLazy;
+
+/** Asynchronously clears a lazy installation's "lazy" flag, which starts the download of its
+    channel's full contents. Call this before the app starts using the localDatabase.
+    Progress can be tracked with -[SyncpointClient hydrationProgressOfInstallation:].
+    @return  The save operation, already started; or nil if the installation isn't lazy. */
+- (RESTOperation*) hydrate;
+
+/** Does this installation sync in one-shot bursts instead of continuously?
+    See -[SyncpointClient setSyncMode:forChannelNamed:]. */
+@property (readonly) bool syncsInBursts;
+
+/** Changes whether this installation syncs in bursts, and saves it. */
+- (BOOL) setSyncsInBursts: (bool)bursts error: (NSError**)outError;
+
 /** The subscription this is associated with. */
 @property (readonly) SyncpointSubscription* subscription;
 
@@ -141,6 +183,8 @@
 /** The session this is associated with. */
 @property (readonly) SyncpointSession* session;
 
+/** Deletes this installation. The SyncpointClient then stops its replications and, if the local
+    database is one Syncpoint created, deletes that database too. */
 - (BOOL) uninstall: (NSError**)outError;
 
 @end
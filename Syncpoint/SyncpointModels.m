@@ -8,7 +8,9 @@
 
 #import "SyncpointModels.h"
 #import "SyncpointInternal.h"
+#import "SyncpointTrace.h"
 #import "CouchModelFactory.h"
+#import "CouchDesignDocument_Embedded.h"
 #import "TDMisc.h"
 #import "CollectionUtils.h"
 #import <Security/SecRandom.h>
@@ -27,23 +29,88 @@ static NSString* randomString(void) {
 }
 
 
-//TODO: This would be useful as a method in CouchModelFactory or CouchDatabase...
-static NSEnumerator* modelsOfType(CouchDatabase* database, NSString* type) {
-    NSEnumerator* e = [[database getAllDocuments] rows];
-    return [e my_map: ^(CouchQueryRow* row) {
-        if ([type isEqual: [row.documentProperties objectForKey: @"type"]])
-            return [CouchModel modelForDocument: row.document];
-        else
-            return nil;
+#define kIndexDesignDocName @"syncpoint"
+
+// NSUserDefaults keys for the IDs of the session documents: a dictionary keyed by app ID, and the
+// single ID used before there could be more than one session.
+#define kSessionIDsKey @"Syncpoint_SessionDocIDs"
+#define kLegacySessionIDKey @"Syncpoint_SessionDocID"
+
+// Local databases whose installation documents are still being saved, by any session. (This is
+// shared because any session's client may reclaim unused databases.)
+static NSMutableSet* sInstallingDatabaseNames;
+
+
+// Defines the views that index the control database's model documents. TouchDB keeps these
+// persistent and updates them incrementally, so lookups don't have to scan every document.
+static void defineIndexViews(CouchDatabase* database) {
+    CouchDesignDocument* design = [database designDocumentWithName: kIndexDesignDocName];
+    // All model documents, keyed by type:
+    [design defineViewNamed: @"by_type" mapBlock: MAPBLOCK({
+        id type = [doc objectForKey: @"type"];
+        if (type) emit(type, nil);
+    }) version: @"1.0"];
+    // Channels, keyed by name:
+    [design defineViewNamed: @"channels_by_name" mapBlock: MAPBLOCK({
+        if ([[doc objectForKey: @"type"] isEqual: @"channel"])
+            emit([doc objectForKey: @"name"], nil);
+    }) version: @"1.0"];
+    // Subscriptions and installations, keyed by [type, channel_id]:
+    [design defineViewNamed: @"by_channel" mapBlock: MAPBLOCK({
+        id channelID = [doc objectForKey: @"channel_id"];
+        if (channelID) emit($array([doc objectForKey: @"type"], channelID), nil);
+    }) version: @"1.0"];
+    // Installations, keyed by session_id:
+    [design defineViewNamed: @"installations_by_session" mapBlock: MAPBLOCK({
+        if ([[doc objectForKey: @"type"] isEqual: @"installation"])
+            emit([doc objectForKey: @"session_id"], nil);
+    }) version: @"1.0"];
+    // Documents belonging to a session or local user, for pushing to its remote control database.
+    // (Documents saved before they were tagged with user_id fall back to owner_id.)
+    [design defineFilterNamed: @"owned" block: FILTERBLOCK({
+        NSString* sessionID = [params objectForKey: @"session_id"];
+        if (sessionID && [[revision objectForKey: @"_id"] isEqual: sessionID])
+            return YES;
+        NSString* userID = [params objectForKey: @"user_id"];
+        id docUserID = [revision objectForKey: @"user_id"] ?: [revision objectForKey: @"owner_id"];
+        return userID && [docUserID isEqual: userID];
+    })];
+}
+
+
+// Returns the models of all documents whose key in the given index view equals 'key'.
+static NSEnumerator* modelsWithKey(CouchDatabase* database, NSString* viewName, id key) {
+    CouchQuery* query = [[database designDocumentWithName: kIndexDesignDocName]
+                                                queryViewNamed: viewName];
+    query.startKey = key;
+    query.endKey = key;
+    query.prefetch = YES;
+    return [query.rows my_map: ^(CouchQueryRow* row) {
+        return [CouchModel modelForDocument: row.document];
     }];
 }
 
 
+static NSEnumerator* modelsOfType(CouchDatabase* database, NSString* type) {
+    return modelsWithKey(database, @"by_type", type);
+}
+
+
+// Saves a model synchronously, tracing how long it takes.
+static BOOL saveModel(CouchModel* model, NSError** outError) {
+    SyncpointTraceBegin(kSyncpointTraceSave, 1);
+    BOOL ok = [[model save] wait: outError];
+    SyncpointTraceEnd(kSyncpointTraceSave, 1);
+    return ok;
+}
+
+
 
 
 @implementation SyncpointModel
 
 @dynamic state;
+@synthesize owningSession=_owningSession;
 
 - (bool) isActive {
     return [self.state isEqual: @"active"];
@@ -71,14 +138,31 @@ static NSEnumerator* modelsOfType(CouchDatabase* database, NSString* type) {
 
 @implementation SyncpointSession
 {
-    NSMutableArray* _toBeInstalled;
-}
-
-@dynamic user_id, oauth_creds, control_database;
-
-
-+ (SyncpointSession*) sessionInDatabase: (CouchDatabase *)database {
-    NSString* sessID = [[NSUserDefaults standardUserDefaults] objectForKey:@"Syncpoint_SessionDocID"];
+    NSMutableDictionary* _toBeInstalled;        // channel name -> CouchDatabase or NSNull
+    NSMutableSet* _toBeInstalledLazily;         // names of channels in _toBeInstalled to hydrate lazily
+
+    // Resolved object graph of the models in this session, patched as the database changes.
+    // Every model filed under a name or channel ID is kept, in case there are duplicates;
+    // lookups return the first one.
+    NSMutableDictionary* _channels;             // channel ID -> SyncpointChannel
+    NSMutableDictionary* _channelsByName;       // name -> NSMutableArray of SyncpointChannel
+    NSMutableDictionary* _subscriptions;        // channel ID -> NSMutableArray of SyncpointSubscription
+    NSMutableDictionary* _installations;        // channel ID -> NSMutableArray of local SyncpointInstallation
+    NSMutableDictionary* _graphEntries;         // doc ID -> [map, key] it's filed under
+    NSSet* _installedSubscriptions;             // cache; cleared when the graph changes
+}
+
+@dynamic user_id, app_id, oauth_creds, control_database;
+
+
++ (SyncpointSession*) sessionInDatabase: (CouchDatabase *)database appId: (NSString*)appId {
+    NSUserDefaults* defaults = [NSUserDefaults standardUserDefaults];
+    NSMutableDictionary* sessionIDs = [[defaults dictionaryForKey: kSessionIDsKey] mutableCopy]
+                                        ?: [NSMutableDictionary dictionary];
+    NSString* sessID = appId ? [sessionIDs objectForKey: appId] : nil;
+    BOOL legacy = !sessID;
+    if (legacy)
+        sessID = [defaults objectForKey: kLegacySessionIDKey];
     if (!sessID)
         return nil;
     CouchDocument* doc = [database documentWithID: sessID];
@@ -86,9 +170,22 @@ static NSEnumerator* modelsOfType(CouchDatabase* database, NSString* type) {
         return nil;
     if (!doc.properties) {
         // Oops -- the session ID in user-defaults is out of date, so clear it
-        [[NSUserDefaults standardUserDefaults] removeObjectForKey: @"Syncpoint_SessionDocID"];
+        if (legacy)
+            [defaults removeObjectForKey: kLegacySessionIDKey];
+        else {
+            [sessionIDs removeObjectForKey: appId];
+            [defaults setObject: sessionIDs forKey: kSessionIDsKey];
+        }
         return nil;
     }
+    if (legacy && appId) {
+        // A session saved before there could be several; it's only ours if the app ID matches.
+        if (![[doc.properties objectForKey: @"app_id"] isEqual: appId])
+            return nil;
+        [sessionIDs setObject: sessID forKey: appId];
+        [defaults setObject: sessionIDs forKey: kSessionIDsKey];
+        [defaults removeObjectForKey: kLegacySessionIDKey];
+    }
     return [self modelForDocument: doc];
 }
 
@@ -112,7 +209,7 @@ static NSEnumerator* modelsOfType(CouchDatabase* database, NSString* type) {
                                       {@"token", randomString()});
     session.oauth_creds = oauth_creds;
     
-    if (![[session save] wait: outError]) {
+    if (!saveModel(session, outError)) {
         Warn(@"SyncpointSession: Couldn't save new session");
         return nil;
     }
@@ -120,25 +217,38 @@ static NSEnumerator* modelsOfType(CouchDatabase* database, NSString* type) {
     NSString* sessionID = session.document.documentID;
     LogTo(Syncpoint, @"...session ID = %@", sessionID);
     NSUserDefaults *defaults = [NSUserDefaults standardUserDefaults];
-    [defaults setObject: sessionID forKey: @"Syncpoint_SessionDocID"];
+    if (appId) {
+        NSMutableDictionary* sessionIDs = [[defaults dictionaryForKey: kSessionIDsKey] mutableCopy]
+                                            ?: [NSMutableDictionary dictionary];
+        [sessionIDs setObject: sessionID forKey: appId];
+        [defaults setObject: sessionIDs forKey: kSessionIDsKey];
+    } else {
+        [defaults setObject: sessionID forKey: kLegacySessionIDKey];
+    }
     [defaults synchronize];
+    [session setUpDatabase];
     return session;
 }
 
 
 - (id) initWithDocument: (CouchDocument*)document {
     self = [super initWithDocument: document];
-    if (self) {
-        // Register the other model classes with the database's model factory:
-        CouchModelFactory* factory = self.database.modelFactory;
-        [factory registerClass: @"SyncpointChannel" forDocumentType: @"channel"];
-        [factory registerClass: @"SyncpointSubscription" forDocumentType: @"subscription"];
-        [factory registerClass: @"SyncpointInstallation" forDocumentType: @"installation"];
-    }
+    if (self && document)
+        [self setUpDatabase];
     return self;
 }
 
 
+- (void) setUpDatabase {
+    // Register the other model classes with the database's model factory:
+    CouchModelFactory* factory = self.database.modelFactory;
+    [factory registerClass: @"SyncpointChannel" forDocumentType: @"channel"];
+    [factory registerClass: @"SyncpointSubscription" forDocumentType: @"subscription"];
+    [factory registerClass: @"SyncpointInstallation" forDocumentType: @"installation"];
+    defineIndexViews(self.database);
+}
+
+
 - (NSError*) error {
     if (![self.state isEqual: @"error"])
         return nil;
@@ -154,10 +264,156 @@ static NSEnumerator* modelsOfType(CouchDatabase* database, NSString* type) {
 - (BOOL) clearState: (NSError**)outError {
     self.state = @"new";
     [self setValue: nil ofProperty: @"error"];
-    return [[self save] wait: outError];
+    return saveModel(self, outError);
+}
+
+
+#pragma mark - OBJECT GRAPH:
+
+
+static id firstCandidate(NSDictionary* map, id key) {
+    NSArray* candidates = [map objectForKey: key];
+    return candidates.count ? [candidates objectAtIndex: 0] : nil;
+}
+
+static void addCandidate(NSMutableDictionary* map, id key, SyncpointModel* model) {
+    NSMutableArray* candidates = [map objectForKey: key];
+    if (!candidates) {
+        candidates = [NSMutableArray array];
+        [map setObject: candidates forKey: key];
+    }
+    [candidates addObject: model];
+}
+
+static void removeCandidate(NSMutableDictionary* map, id key, NSString* docID) {
+    NSMutableArray* candidates = [map objectForKey: key];
+    NSUInteger i = [candidates indexOfObjectPassingTest: ^BOOL(id model, NSUInteger idx, BOOL *stop) {
+        return [[model document].documentID isEqual: docID];
+    }];
+    if (i != NSNotFound)
+        [candidates removeObjectAtIndex: i];
+    if (candidates.count == 0)
+        [map removeObjectForKey: key];
+}
+
+
+// Builds the object graph from the index views, the first time it's needed.
+- (void) loadGraph {
+    if (_channels)
+        return;
+    SyncpointTraceBegin(kSyncpointTraceGraphLoad, 0);
+    _channels = [[NSMutableDictionary alloc] init];
+    _channelsByName = [[NSMutableDictionary alloc] init];
+    _subscriptions = [[NSMutableDictionary alloc] init];
+    _installations = [[NSMutableDictionary alloc] init];
+    _graphEntries = [[NSMutableDictionary alloc] init];
+    for (NSString* type in $array(@"channel", @"subscription", @"installation"))
+        for (SyncpointModel* model in modelsOfType(self.database, type))
+            [self addToGraph: model];
+
+    // From now on, patch the graph in place as documents change:
+    __weak SyncpointSession* weakSelf = self;
+    [self.database onChange: ^(CouchDocument* doc, BOOL externalChange) {
+        [weakSelf updateGraphForDocument: doc];
+    }];
+    SyncpointTraceEnd(kSyncpointTraceGraphLoad, (uint32_t)_channels.count);
+}
+
+
+// Other apps' and accounts' sessions can share the control database, so only documents tagged
+// with this session's app ID (or not tagged) belong in its graph. Subscriptions and installations
+// must also have been made by this session's local user. (Not owner_id: that's the owner of the
+// channel, who may be someone else. And channels are shared between users, so any user may have
+// made one.)
+- (BOOL) ownsModel: (SyncpointModel*)model {
+    NSString* appID = [model getValueOfProperty: @"app_id"];
+    if (appID && ![appID isEqual: self.app_id])
+        return NO;
+    if ([[model getValueOfProperty: @"type"] isEqual: @"channel"])
+        return YES;
+    NSString* docUserID = [model getValueOfProperty: @"user_id"];
+    NSString* userID = self.user_id;
+    return !docUserID || !userID || [docUserID isEqual: userID];
+}
+
+
+- (void) removeFromGraph: (NSString*)docID {
+    [_channels removeObjectForKey: docID];
+    NSArray* entry = [_graphEntries objectForKey: docID];
+    if (entry) {
+        removeCandidate([entry objectAtIndex: 0], [entry objectAtIndex: 1], docID);
+        [_graphEntries removeObjectForKey: docID];
+    }
+    _installedSubscriptions = nil;
+}
+
+
+- (void) addToGraph: (SyncpointModel*)model {
+    if (!_channels)
+        return;     // Graph isn't loaded yet; the model will be picked up when it is
+    NSString* type = [model getValueOfProperty: @"type"];
+    NSString* docID = model.document.documentID;
+    [self removeFromGraph: docID];
+    if (![self ownsModel: model])
+        return;
+    NSMutableDictionary* map = nil;
+    NSString* key = nil;
+    if ([type isEqual: @"channel"]) {
+        [_channels setObject: model forKey: docID];
+        map = _channelsByName;
+        key = ((SyncpointChannel*)model).name;
+    } else if ([type isEqual: @"subscription"]) {
+        map = _subscriptions;
+        key = [model getValueOfProperty: @"channel_id"];
+    } else if ([type isEqual: @"installation"]) {
+        if ([[model getValueOfProperty: @"session_id"] isEqual: self.document.documentID]) {
+            map = _installations;
+            key = [model getValueOfProperty: @"channel_id"];
+        }
+    } else {
+        return;
+    }
+    if (map && key) {
+        addCandidate(map, key, model);
+        [_graphEntries setObject: $array(map, key) forKey: docID];
+    }
+    model.owningSession = self;
+    _installedSubscriptions = nil;
+}
+
+
+// Called when a document in the control database changes.
+- (void) updateGraphForDocument: (CouchDocument*)doc {
+    if (!_channels)
+        return;
+    [self removeFromGraph: doc.documentID];
+    if (doc.isDeleted)
+        return;
+    SyncpointModel* model = $castIf(SyncpointModel, [CouchModel modelForDocument: doc]);
+    if (model)
+        [self addToGraph: model];
+}
+
+
+- (SyncpointSubscription*) subscriptionForChannelID: (NSString*)channelID {
+    [self loadGraph];
+    SyncpointSubscription* sub = firstCandidate(_subscriptions, channelID);
+    SyncpointTrace(kSyncpointTraceModelLookup, sub != nil);
+    return sub;
+}
+
+
+- (SyncpointInstallation*) installationForChannelID: (NSString*)channelID {
+    [self loadGraph];
+    SyncpointInstallation* inst = firstCandidate(_installations, channelID);
+    SyncpointTrace(kSyncpointTraceModelLookup, inst != nil);
+    return inst;
 }
 
 
+#pragma mark - CHANNELS:
+
+
 - (SyncpointChannel*) makeChannelWithName: (NSString*)name
                                     error: (NSError**)outError
 {
@@ -165,87 +421,322 @@ static NSEnumerator* modelsOfType(CouchDatabase* database, NSString* type) {
     SyncpointChannel* channel = [[SyncpointChannel alloc] initWithNewDocumentInDatabase: self.database];
     [channel setValue: @"channel" ofProperty: @"type"];
     [channel setValue: self.user_id ofProperty: @"owner_id"];
+    [channel setValue: self.user_id ofProperty: @"user_id"];
+    [channel setValue: self.app_id ofProperty: @"app_id"];
     channel.state = @"new";
     channel.name = name;
-    return [[channel save] wait: outError] ? channel : nil;
+    if (!saveModel(channel, outError))
+        return nil;
+    [self addToGraph: channel];
+    return channel;
 }
 
 
 - (SyncpointChannel*) channelWithName: (NSString*)name {
-    // TODO: Make this into a view query
-    for (SyncpointChannel* channel in modelsOfType(self.database, @"channel"))
-        if ([channel.name isEqualToString: name])
-            return channel;
-    return nil;
+    [self loadGraph];
+    SyncpointChannel* channel = firstCandidate(_channelsByName, name);
+    SyncpointTrace(kSyncpointTraceModelLookup, channel != nil);
+    return channel;
+}
+
+
+- (SyncpointInstallation*) installChannelNamed: (NSString*)channelName
+                                    toDatabase: (CouchDatabase*)localDatabase
+                                         error: (NSError**)outError
+{
+    return [self installChannelNamed: channelName toDatabase: localDatabase
+                              lazily: NO error: outError];
 }
 
 
 - (SyncpointInstallation*) installChannelNamed: (NSString*)channelName
                                     toDatabase: (CouchDatabase*)localDatabase
+                                        lazily: (BOOL)lazily
                                          error: (NSError**)outError
 {
-    LogTo(Syncpoint, @"Install channel named '%@' to %@", channelName, localDatabase);
+    LogTo(Syncpoint, @"Install channel named '%@' to %@%@",
+          channelName, localDatabase, (lazily ? @" (lazily)" : @""));
     if (self.isActive) {
         SyncpointChannel* channel = [self channelWithName: channelName];
         if (!channel)
             channel = [self makeChannelWithName: channelName error: outError];
-        return [channel makeInstallationWithLocalDatabase: localDatabase error: outError];
+        return [channel makeInstallationWithLocalDatabase: localDatabase lazily: lazily
+                                                    error: outError];
     } else {
         // If not activated yet, make a note of what to install:
         LogTo(Syncpoint, @"    ...deferring till session becomes active");
-        if (!_toBeInstalled)
-            _toBeInstalled = $marray();
-        [_toBeInstalled addObject: $array(channelName, localDatabase)];
+        [self deferInstallOfChannelNamed: channelName toDatabase: localDatabase lazily: lazily];
         if (outError) *outError = nil;
         return nil;
     }
 }
 
 
+- (void) deferInstallOfChannelNamed: (NSString*)channelName
+                         toDatabase: (CouchDatabase*)localDatabase
+                             lazily: (BOOL)lazily
+{
+    if (!_toBeInstalled) {
+        _toBeInstalled = [[NSMutableDictionary alloc] init];
+        _toBeInstalledLazily = [[NSMutableSet alloc] init];
+    }
+    [_toBeInstalled setObject: (localDatabase ?: (id)[NSNull null]) forKey: channelName];
+    if (lazily)
+        [_toBeInstalledLazily addObject: channelName];
+    else
+        [_toBeInstalledLazily removeObject: channelName];
+}
+
+
+- (RESTOperation*) beginInstallingChannelNamed: (NSString*)channelName
+                                    toDatabase: (CouchDatabase*)localDatabase
+{
+    return [self beginInstallingChannels:
+                        $dict({channelName, (localDatabase ?: (id)[NSNull null])})];
+}
+
+
+- (RESTOperation*) beginInstallingChannels: (NSDictionary*)databasesByChannelName {
+    return [self beginInstallingChannels: databasesByChannelName lazily: nil];
+}
+
+
+- (RESTOperation*) beginInstallingChannels: (NSDictionary*)databasesByChannelName
+                                    lazily: (NSSet*)lazyChannelNames
+{
+    if (!self.isActive) {
+        LogTo(Syncpoint, @"Deferring install of %u channels till session becomes active",
+              (unsigned)databasesByChannelName.count);
+        for (NSString* channelName in databasesByChannelName)
+            [self deferInstallOfChannelNamed: channelName
+                                  toDatabase: $castIf(CouchDatabase,
+                                            [databasesByChannelName objectForKey: channelName])
+                                      lazily: [lazyChannelNames containsObject: channelName]];
+        return nil;
+    }
+
+    // Collect the properties of all the documents that need to be created. They're given IDs
+    // up front so that they can refer to each other before they're saved.
+    NSString* ownerID = self.user_id;
+    NSString* appID = self.app_id;
+    NSMutableArray* docs = $marray();
+    NSMutableArray* creates = $marray();
+    NSMutableArray* createdInstallationIDs = $marray();   // parallel to 'creates'
+    NSMutableDictionary* dependencies = [NSMutableDictionary dictionary]; // inst. ID -> new doc IDs
+    NSMutableSet* installingDatabaseNames = [NSMutableSet set];
+    for (NSString* channelName in databasesByChannelName) {
+        NSMutableArray* newDocIDs = $marray();
+        SyncpointChannel* channel = [self channelWithName: channelName];
+        NSString* channelID = channel.document.documentID;
+        NSString* channelOwnerID = channel ? channel.owner_id : ownerID;
+        if (!channelID) {
+            channelID = randomString();
+            [newDocIDs addObject: channelID];
+            [docs addObject: $dict({@"_id", channelID},
+                                   {@"type", @"channel"},
+                                   {@"state", @"new"},
+                                   {@"owner_id", ownerID},
+                                   {@"user_id", ownerID},
+                                   {@"app_id", appID},
+                                   {@"name", channelName})];
+        }
+        if ([self installationForChannelID: channelID])
+            continue;
+        NSString* subscriptionID = [self subscriptionForChannelID: channelID].document.documentID;
+        if (!subscriptionID) {
+            subscriptionID = randomString();
+            [newDocIDs addObject: subscriptionID];
+            [docs addObject: $dict({@"_id", subscriptionID},
+                                   {@"type", @"subscription"},
+                                   {@"state", @"active"},
+                                   {@"owner_id", channelOwnerID},
+                                   {@"user_id", ownerID},
+                                   {@"app_id", appID},
+                                   {@"channel_id", channelID})];
+        }
+        CouchDatabase* localDB = $castIf(CouchDatabase,
+                                         [databasesByChannelName objectForKey: channelName]);
+        if (!localDB)
+            localDB = [self.database.server databaseNamed:
+                                        [kLocalChannelDatabasePrefix stringByAppendingString: randomString()]];
+        NSString* installationID = randomString();
+        [creates addObject: [localDB create]];
+        [createdInstallationIDs addObject: installationID];
+        [dependencies setObject: newDocIDs forKey: installationID];
+        [installingDatabaseNames addObject: localDB.relativePath];
+        NSMutableDictionary* installation = $mdict({@"_id", installationID},
+                               {@"type", @"installation"},
+                               {@"state", @"created"},
+                               {@"owner_id", channelOwnerID},
+                               {@"user_id", ownerID},
+                               {@"app_id", appID},
+                               {@"local_db_name", localDB.relativePath},
+                               {@"channel_id", channelID},
+                               {@"subscription_id", subscriptionID},
+                               {@"session_id", self.document.documentID});
+        if ([lazyChannelNames containsObject: channelName])
+            [installation setObject: $true forKey: @"lazy"];
+        [docs addObject: installation];
+    }
+    if (docs.count == 0)
+        return nil;
+
+    LogTo(Syncpoint, @"Installing %u channels: bulk-saving %u documents",
+          (unsigned)databasesByChannelName.count, (unsigned)docs.count);
+    NSMutableSet* failedInstallationIDs = [NSMutableSet set];
+    if (!sInstallingDatabaseNames)
+        sInstallingDatabaseNames = [[NSMutableSet alloc] init];
+    [sInstallingDatabaseNames unionSet: installingDatabaseNames];
+    SyncpointTraceBegin(kSyncpointTraceSave, (uint32_t)docs.count);
+    RESTOperation* op = [self.database putChanges: docs];
+    [op onCompletion: ^{
+        SyncpointTraceEnd(kSyncpointTraceSave, (uint32_t)docs.count);
+        [sInstallingDatabaseNames minusSet: installingDatabaseNames];
+        if (op.error) {
+            Warn(@"SyncpointSession: Couldn't save installations: %@", op.error);
+            return;
+        }
+        [self bulkInstallCompleted: $castIf(NSArray, op.responseBody.fromJSON)
+                      dependencies: dependencies
+                   failedDatabases: failedInstallationIDs];
+    }];
+
+    // Don't save the installations till their local databases exist, or the client could start
+    // replicating into a database that hasn't been created yet:
+    __block NSUInteger createsPending = creates.count;
+    [creates enumerateObjectsUsingBlock: ^(RESTOperation* create, NSUInteger i, BOOL *stop) {
+        NSString* installationID = [createdInstallationIDs objectAtIndex: i];
+        [create onCompletion: ^{
+            if (create.error && create.httpStatus != 412) {     // 412 means it already exists
+                Warn(@"SyncpointSession: Couldn't create database for installation %@: %@",
+                     installationID, create.error);
+                [failedInstallationIDs addObject: installationID];
+            }
+            if (--createsPending == 0)
+                [op start];
+        }];
+        [create start];
+    }];
+    if (creates.count == 0)
+        [op start];
+    return op;
+}
+
+
+// Processes the per-document results of a bulk install. Saved documents are added to the graph,
+// except for installations whose local database couldn't be created, or which refer to a new
+// channel or subscription that failed to save; those are deleted again.
+- (void) bulkInstallCompleted: (NSArray*)results
+                 dependencies: (NSDictionary*)dependencies
+              failedDatabases: (NSSet*)failedInstallationIDs
+{
+    NSMutableDictionary* savedRevs = [NSMutableDictionary dictionary];     // doc ID -> rev ID
+    for (NSDictionary* result in results) {
+        NSString* docID = [result objectForKey: @"id"];
+        NSString* revID = [result objectForKey: @"rev"];
+        if (docID && revID)
+            [savedRevs setObject: revID forKey: docID];
+        else
+            Warn(@"SyncpointSession: Couldn't save %@: %@", docID, [result objectForKey: @"error"]);
+    }
+
+    NSMutableArray* rollbacks = $marray();
+    for (NSString* installationID in dependencies) {
+        NSString* revID = [savedRevs objectForKey: installationID];
+        if (!revID)
+            continue;
+        BOOL ok = ![failedInstallationIDs containsObject: installationID];
+        for (NSString* docID in [dependencies objectForKey: installationID])
+            if (![savedRevs objectForKey: docID])
+                ok = NO;
+        if (!ok) {
+            LogTo(Syncpoint, @"Rolling back incomplete installation %@", installationID);
+            [rollbacks addObject: $dict({@"_id", installationID},
+                                        {@"_rev", revID},
+                                        {@"_deleted", $true})];
+            [savedRevs removeObjectForKey: installationID];
+        }
+    }
+
+    for (NSString* docID in savedRevs) {
+        CouchDocument* doc = [self.database documentWithID: docID];
+        [self addToGraph: (SyncpointModel*)[CouchModel modelForDocument: doc]];
+    }
+    if (rollbacks.count > 0) {
+        RESTOperation* op = [self.database putChanges: rollbacks];
+        [op onCompletion: ^{
+            if (op.error)
+                Warn(@"SyncpointSession: Couldn't roll back installations: %@", op.error);
+        }];
+        [op start];
+    }
+}
+
+
 - (void) didLoadFromDocument {
     [super didLoadFromDocument];
     
     if (_toBeInstalled && self.isActive) {
         LogTo(Syncpoint, @"Installing %u pending channels...", _toBeInstalled.count);
-        NSMutableArray* toInstall = _toBeInstalled;
+        NSDictionary* toInstall = _toBeInstalled;
+        NSSet* lazily = _toBeInstalledLazily;
         _toBeInstalled = nil;
-        for (NSArray* info in toInstall) {
-             [self installChannelNamed: [info objectAtIndex: 0]
-                            toDatabase: [info objectAtIndex: 1]
-                                 error: nil];
-        }
+        _toBeInstalledLazily = nil;
+        [self beginInstallingChannels: toInstall lazily: lazily];
     }
 }
 
 
 - (NSEnumerator*) readyChannels {
-    // TODO: Make this into a view query
-    return [modelsOfType(self.database, @"channel") my_map: ^(SyncpointChannel* channel) {
+    [self loadGraph];
+    return [[_channels objectEnumerator] my_map: ^(SyncpointChannel* channel) {
         return channel.isReady ? channel : nil;
     }];
 }
 
 
 - (NSEnumerator*) activeSubscriptions {
-    // TODO: Make this into a view query
-    return [modelsOfType(self.database, @"subscripton") my_map: ^(SyncpointSubscription* sub) {
+    [self loadGraph];
+    return [[_subscriptions objectEnumerator] my_map: ^(NSArray* candidates) {
+        SyncpointSubscription* sub = [candidates objectAtIndex: 0];
         return sub.isActive ? sub : nil;
     }];
 }
 
 
 - (NSSet*) installedSubscriptions {
-    NSMutableSet* subscriptions = [NSMutableSet set];
-    for (SyncpointInstallation* inst in self.allInstallations)
-        [subscriptions addObject: inst.subscription];
-    return subscriptions;
+    if (!_installedSubscriptions) {
+        NSMutableSet* subscriptions = [NSMutableSet set];
+        for (SyncpointInstallation* inst in self.allInstallations) {
+            NSString* channelID = [inst getValueOfProperty: @"channel_id"];
+            SyncpointSubscription* sub = firstCandidate(_subscriptions, channelID);
+            if (sub)
+                [subscriptions addObject: sub];
+        }
+        _installedSubscriptions = [subscriptions copy];
+    }
+    return _installedSubscriptions;
+}
+
+
+- (NSSet*) localDatabaseNames {
+    NSMutableSet* names = [NSMutableSet set];
+    if (sInstallingDatabaseNames)
+        [names unionSet: sInstallingDatabaseNames];
+    for (SyncpointInstallation* inst in modelsOfType(self.database, @"installation")) {
+        NSString* name = $castIf(NSString, [inst getValueOfProperty: @"local_db_name"]);
+        if (name)
+            [names addObject: name];
+    }
+    return names;
 }
 
 
 - (NSEnumerator*) allInstallations {
-    // TODO: Make this into a view query
-    return [modelsOfType(self.database, @"installation") my_map: ^(SyncpointInstallation* inst) {
-        return ([inst.state isEqual: @"created"] && inst.session == self) ? inst : nil;
+    [self loadGraph];
+    return [[_installations objectEnumerator] my_map: ^(NSArray* candidates) {
+        SyncpointInstallation* inst = [candidates objectAtIndex: 0];
+        return [inst.state isEqual: @"created"] ? inst : nil;
     }];
 }
 
@@ -257,7 +748,7 @@ static NSEnumerator* modelsOfType(CouchDatabase* database, NSString* type) {
 
 @implementation SyncpointChannel
 
-@dynamic name, owner_id, cloud_database;
+@dynamic name, owner_id, cloud_database, snapshot_url;
 
 - (bool) isReady {
     return [self.state isEqual: @"ready"];
@@ -265,18 +756,21 @@ static NSEnumerator* modelsOfType(CouchDatabase* database, NSString* type) {
 
 
 - (SyncpointSubscription*) subscription {
-    // TODO: Make this into a view query
-    for (SyncpointSubscription* sub in modelsOfType(self.database, @"subscription"))
-        if (sub.channel == self)
-            return sub;
-    return nil;
+    SyncpointSession* session = self.owningSession;
+    if (session)
+        return [session subscriptionForChannelID: self.document.documentID];
+    NSArray* key = $array(@"subscription", self.document.documentID);
+    return [modelsWithKey(self.database, @"by_channel", key) nextObject];
 }
 
 
 - (SyncpointInstallation*) installation {
-    // TODO: Make this into a view query
-    for (SyncpointInstallation* inst in modelsOfType(self.database, @"installation"))
-        if (inst.channel == self && inst.isLocal)
+    SyncpointSession* session = self.owningSession;
+    if (session)
+        return [session installationForChannelID: self.document.documentID];
+    NSArray* key = $array(@"installation", self.document.documentID);
+    for (SyncpointInstallation* inst in modelsWithKey(self.database, @"by_channel", key))
+        if (inst.isLocal)
             return inst;
     return nil;
 }
@@ -284,7 +778,14 @@ static NSEnumerator* modelsOfType(CouchDatabase* database, NSString* type) {
 
 - (SyncpointInstallation*) makeInstallationWithLocalDatabase: (CouchDatabase*)localDatabase
                                                        error: (NSError**)outError
+{
+    return [self makeInstallationWithLocalDatabase: localDatabase lazily: NO error: outError];
+}
+
 
+- (SyncpointInstallation*) makeInstallationWithLocalDatabase: (CouchDatabase*)localDatabase
+                                                      lazily: (BOOL)lazily
+                                                       error: (NSError**)outError
 {
     SyncpointSubscription* subscription = self.subscription;
     SyncpointInstallation* installation = self.installation;
@@ -299,6 +800,7 @@ static NSEnumerator* modelsOfType(CouchDatabase* database, NSString* type) {
     
     if (!installation)
         installation = [subscription makeInstallationWithLocalDatabase: localDatabase
+                                                                lazily: lazily
                                                                  error: outError];
     return installation;
 }
@@ -310,8 +812,14 @@ static NSEnumerator* modelsOfType(CouchDatabase* database, NSString* type) {
     [sub setValue: @"subscription" ofProperty: @"type"];
     sub.state = @"active";
     [sub setValue: [self getValueOfProperty: @"owner_id"] ofProperty: @"owner_id"];
+    [sub setValue: self.owningSession.user_id ofProperty: @"user_id"];
+    [sub setValue: (self.owningSession.app_id ?: [self getValueOfProperty: @"app_id"])
+       ofProperty: @"app_id"];
     sub.channel = self;
-    return [[sub save] wait: outError] ? sub : nil;
+    if (!saveModel(sub, outError))
+        return nil;
+    [self.owningSession addToGraph: sub];
+    return sub;
 }
 
 @end
@@ -325,28 +833,35 @@ static NSEnumerator* modelsOfType(CouchDatabase* database, NSString* type) {
 
 
 - (SyncpointInstallation*) installation {
+    SyncpointSession* session = self.owningSession;
+    if (session)
+        return [session installationForChannelID: [self getValueOfProperty: @"channel_id"]];
     return self.channel.installation;
 }
 
 
 - (SyncpointInstallation*) allInstallations {
-    SyncpointChannel* channel = self.channel;
-    // TODO: Make this into a view query
-    for (SyncpointInstallation* inst in modelsOfType(self.database, @"installation"))
-        if (inst.channel == channel)
-            return inst;
-    return nil;
+    NSArray* key = $array(@"installation", [self getValueOfProperty: @"channel_id"]);
+    return [modelsWithKey(self.database, @"by_channel", key) nextObject];
 }
 
 
 - (SyncpointInstallation*) makeInstallationWithLocalDatabase: (CouchDatabase*)localDB
                                                        error: (NSError**)outError
+{
+    return [self makeInstallationWithLocalDatabase: localDB lazily: NO error: outError];
+}
+
+
+- (SyncpointInstallation*) makeInstallationWithLocalDatabase: (CouchDatabase*)localDB
+                                                      lazily: (BOOL)lazily
+                                                       error: (NSError**)outError
 {
     NSString* name;
     if (localDB)
         name = localDB.relativePath;
     else { 
-        name = [@"channel-" stringByAppendingString: randomString()];
+        name = [kLocalChannelDatabasePrefix stringByAppendingString: randomString()];
         localDB = [self.database.server databaseNamed: name];
     }
     
@@ -359,12 +874,21 @@ static NSEnumerator* modelsOfType(CouchDatabase* database, NSString* type) {
     SyncpointInstallation* inst = [[SyncpointInstallation alloc] initWithNewDocumentInDatabase: self.database];
     [inst setValue: @"installation" ofProperty: @"type"];
     inst.state = @"created";
-    inst.session = [SyncpointSession sessionInDatabase: self.database];
+    SyncpointSession* session = self.owningSession;
+    NSString* appID = session.app_id ?: [self getValueOfProperty: @"app_id"];
+    inst.session = session ?: [SyncpointSession sessionInDatabase: self.database appId: appID];
     [inst setValue: [self getValueOfProperty: @"owner_id"] ofProperty: @"owner_id"];
+    [inst setValue: inst.session.user_id ofProperty: @"user_id"];
+    [inst setValue: appID ofProperty: @"app_id"];
     inst.channel = self.channel;
     inst.subscription = self;
     [inst setValue: name ofProperty: @"local_db_name"];
-    return [[inst save] wait: outError] ? inst : nil;
+    if (lazily)
+        [inst setValue: $true ofProperty: @"lazy"];
+    if (!saveModel(inst, outError))
+        return nil;
+    [session addToGraph: inst];
+    return inst;
 }
 
 
@@ -372,8 +896,9 @@ static NSEnumerator* modelsOfType(CouchDatabase* database, NSString* type) {
     SyncpointInstallation* inst = self.installation;
     if (inst && ![inst uninstall: outError])
         return NO;
+    // The installation's local database and replications are reclaimed by the SyncpointClient
+    // once it sees the installation has been deleted.
     return [[self deleteDocument] wait: outError];
-    //????: Is this how to do it?
 }
 
 
@@ -393,8 +918,42 @@ static NSEnumerator* modelsOfType(CouchDatabase* database, NSString* type) {
     return name ? [self.database.server databaseNamed: name] : nil;
 }
 
+- (bool) isLazy {
+    return [[self getValueOfProperty: @"lazy"] boolValue];
+}
+
+- (RESTOperation*) hydrate {
+    if (!self.isLazy)
+        return nil;
+    LogTo(Syncpoint, @"Hydrating %@", self);
+    [self setValue: nil ofProperty: @"lazy"];
+    RESTOperation* op = [self save];
+    [op onCompletion: ^{
+        if (op.error) {
+            Warn(@"SyncpointInstallation: couldn't hydrate %@: %@", self, op.error);
+            [self setValue: $true ofProperty: @"lazy"];     // so it can be tried again
+        }
+    }];
+    [op start];
+    return op;
+}
+
+- (bool) syncsInBursts {
+    return [[self getValueOfProperty: @"sync_mode"] isEqual: @"burst"];
+}
+
+- (BOOL) setSyncsInBursts: (bool)bursts error: (NSError**)outError {
+    if (bursts == self.syncsInBursts)
+        return YES;
+    [self setValue: (bursts ? @"burst" : nil) ofProperty: @"sync_mode"];
+    return saveModel(self, outError);
+}
+
 - (bool) isLocal {
-    SyncpointSession* session = [SyncpointSession sessionInDatabase: self.database];
+    SyncpointSession* session = self.owningSession;
+    if (!session)
+        session = [SyncpointSession sessionInDatabase: self.database
+                                                appId: [self getValueOfProperty: @"app_id"]];
     return [session.document.documentID isEqual: [self getValueOfProperty: @"session_id"]];
 }
 
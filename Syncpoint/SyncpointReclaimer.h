@@ -0,0 +1,43 @@
+//
+//  SyncpointReclaimer.h
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+@class CouchDatabase, SyncpointReplicationRegistry;
+
+
+typedef void (^SyncpointReclaimBlock)(NSDictionary* report);
+typedef NSSet* (^SyncpointDatabaseNamesBlock)(void);
+
+
+/** Frees up local storage that Syncpoint no longer needs: it stops the replications of channels
+    that have been uninstalled, deletes local channel databases no installation refers to, and
+    compacts the control database. */
+@interface SyncpointReclaimer : NSObject
+
+- (id) initWithControlDatabase: (CouchDatabase*)controlDatabase
+                  replications: (SyncpointReplicationRegistry*)replications;
+
+/** Runs a reclamation pass. The work is asynchronous; onComplete is called with a report when
+    it's done. The report's keys are "replications_stopped", "databases_deleted" (an array of
+    names), "bytes_reclaimed" and "control_bytes_reclaimed".
+    @param liveDatabaseNames  Returns the names of local databases that are still installed. It's
+                called again when the list of databases arrives from the server.
+    @param liveOwnerIDs  Document IDs of installations that still exist.
+    @param compact  If YES, the control database is compacted too. */
+- (void) reclaimKeepingDatabases: (SyncpointDatabaseNamesBlock)liveDatabaseNames
+                          owners: (NSSet*)liveOwnerIDs
+                         compact: (BOOL)compact
+                      onComplete: (SyncpointReclaimBlock)onComplete;
+
+/** Is a reclamation pass in progress? */
+@property (readonly) BOOL reclaiming;
+
+/** Total bytes of disk space freed by all passes so far. */
+@property (readonly) UInt64 totalBytesReclaimed;
+
+@end
@@ -0,0 +1,191 @@
+//
+//  SyncpointReclaimer.m
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import "SyncpointReclaimer.h"
+#import "SyncpointReplications.h"
+#import "SyncpointInternal.h"
+#import "CouchCocoa.h"
+
+
+// Asynchronously gets a database's size on disk, as reported by the server; 0 if unknown.
+static void getDiskSize(CouchDatabase* db, void (^onSize)(UInt64 size)) {
+    RESTOperation* op = [db GET];
+    [op onCompletion: ^{
+        NSDictionary* info = op.error ? nil : $castIf(NSDictionary, op.responseBody.fromJSON);
+        onSize([$castIf(NSNumber, [info objectForKey: @"disk_size"]) unsignedLongLongValue]);
+    }];
+    [op start];
+}
+
+
+// Asynchronously gets the names of all the server's databases; an empty array if unknown.
+static void getDatabaseNames(CouchServer* server, void (^onNames)(NSArray* names)) {
+    RESTResource* allDbs = [[RESTResource alloc] initWithParent: server relativePath: @"_all_dbs"];
+    RESTOperation* op = [allDbs GET];
+    [op onCompletion: ^{
+        NSArray* names = op.error ? nil : $castIf(NSArray, op.responseBody.fromJSON);
+        if (!names)
+            Warn(@"SyncpointReclaimer: couldn't list databases: %@", op.error);
+        onNames(names ? names : [NSArray array]);
+    }];
+    [op start];
+}
+
+
+// Should a local database be deleted? Only channel databases that Syncpoint created and that no
+// installation (including one still being installed) refers to. Databases that the app supplied
+// itself don't have the prefix, so they're never deleted.
+static BOOL isOrphanedDatabase(NSString* name, NSSet* liveDatabaseNames) {
+    return [$castIf(NSString, name) hasPrefix: kLocalChannelDatabasePrefix] && ![liveDatabaseNames containsObject: name];
+}
+
+
+@implementation SyncpointReclaimer
+{
+    CouchDatabase* _controlDatabase;
+    SyncpointReplicationRegistry* _replications;
+    BOOL _reclaiming;
+    UInt64 _totalBytesReclaimed;
+}
+
+
+@synthesize reclaiming=_reclaiming, totalBytesReclaimed=_totalBytesReclaimed;
+
+
+- (id) initWithControlDatabase: (CouchDatabase*)controlDatabase
+                  replications: (SyncpointReplicationRegistry*)replications
+{
+    self = [super init];
+    if (self) {
+        _controlDatabase = controlDatabase;
+        _replications = replications;
+    }
+    return self;
+}
+
+
+- (void) reclaimKeepingDatabases: (SyncpointDatabaseNamesBlock)liveDatabaseNames
+                          owners: (NSSet*)liveOwnerIDs
+                         compact: (BOOL)compact
+                      onComplete: (SyncpointReclaimBlock)onComplete
+{
+    Assert(!_reclaiming, @"Reclamation pass already in progress");
+    _reclaiming = YES;
+
+    // Stop replications whose installation is gone, or whose local database is about to be:
+    NSUInteger replicationsStopped = 0;
+    NSSet* initialLiveDatabaseNames = liveDatabaseNames();
+    for (SyncpointReplicationPair* pair in _replications.allPairs) {
+        NSString* dbName = pair.localDatabase.relativePath;
+        BOOL orphanedDB = isOrphanedDatabase(dbName, initialLiveDatabaseNames);
+        if (pair.ownerID && (orphanedDB || ![liveOwnerIDs containsObject: pair.ownerID])) {
+            LogTo(Syncpoint, @"Reclaimer: stopping replications of %@", dbName);
+            [_replications stopReplicationsWithOwnerID: pair.ownerID];
+            ++replicationsStopped;
+        }
+    }
+
+    __block NSUInteger pending = 1;
+    __block UInt64 bytesReclaimed = 0, controlBytesReclaimed = 0;
+    NSMutableArray* deleted = $marray();
+
+    void (^finish)(void) = ^{
+        if (--pending > 0)
+            return;
+        _totalBytesReclaimed += bytesReclaimed + controlBytesReclaimed;
+        _reclaiming = NO;
+        LogTo(Syncpoint, @"Reclaimer: stopped %u replications, deleted %u databases, "
+                          "freed %llu bytes (%llu from control db)",
+              (unsigned)replicationsStopped, (unsigned)deleted.count,
+              bytesReclaimed + controlBytesReclaimed, controlBytesReclaimed);
+        if (onComplete)
+            onComplete($dict({@"replications_stopped", [NSNumber numberWithUnsignedInteger: replicationsStopped]},
+                             {@"databases_deleted", deleted},
+                             {@"bytes_reclaimed", [NSNumber numberWithUnsignedLongLong: bytesReclaimed + controlBytesReclaimed]},
+                             {@"control_bytes_reclaimed", [NSNumber numberWithUnsignedLongLong: controlBytesReclaimed]}));
+    };
+
+    // Delete local channel databases that no installation refers to, after getting their sizes.
+    // The live names are looked up again once the list arrives, in case an installation began
+    // in the meantime:
+    ++pending;
+    CouchServer* server = _controlDatabase.server;
+    getDatabaseNames(server, ^(NSArray* names) {
+        NSSet* currentLiveDatabaseNames = liveDatabaseNames();
+        for (NSString* name in names) {
+            if (!isOrphanedDatabase(name, currentLiveDatabaseNames))
+                continue;
+            CouchDatabase* db = [server databaseNamed: name];
+            ++pending;
+            getDiskSize(db, ^(UInt64 size) {
+                LogTo(Syncpoint, @"Reclaimer: deleting orphaned database %@ (%llu bytes)", name, size);
+                RESTOperation* op = [db DELETE];
+                [op onCompletion: ^{
+                    if (op.error) {
+                        Warn(@"SyncpointReclaimer: couldn't delete %@: %@", name, op.error);
+                    } else {
+                        bytesReclaimed += size;
+                        [deleted addObject: name];
+                    }
+                    finish();
+                }];
+                [op start];
+            });
+        }
+        finish();
+    });
+
+    // Compact the control database, measuring its size before and after:
+    if (compact) {
+        ++pending;
+        CouchDatabase* controlDatabase = _controlDatabase;
+        getDiskSize(controlDatabase, ^(UInt64 sizeBefore) {
+            RESTOperation* op = [controlDatabase compact];
+            [op onCompletion: ^{
+                if (op.error) {
+                    Warn(@"SyncpointReclaimer: couldn't compact control database: %@", op.error);
+                    finish();
+                    return;
+                }
+                getDiskSize(controlDatabase, ^(UInt64 sizeAfter) {
+                    if (sizeAfter < sizeBefore)
+                        controlBytesReclaimed = sizeBefore - sizeAfter;
+                    finish();
+                });
+            }];
+            [op start];
+        });
+    }
+
+    finish();
+}
+
+
+@end
+
+
+
+
+#pragma mark - TESTS:
+#if DEBUG
+
+TestCase(SyncpointReclaimerOrphans) {
+    NSSet* live = [NSSet setWithObjects: @"channel-installed", @"channel-installing", @"groceries", nil];
+    // Installed databases, and ones still being installed, are live:
+    CAssert(!isOrphanedDatabase(@"channel-installed", live));
+    CAssert(!isOrphanedDatabase(@"channel-installing", live));
+    // Databases the app supplied are never deleted, whether or not they're installed:
+    CAssert(!isOrphanedDatabase(@"groceries", live));
+    CAssert(!isOrphanedDatabase(@"recipes", live));
+    CAssert(!isOrphanedDatabase(@"sp_control", live));
+    // Only a Syncpoint-created database that nothing refers to is an orphan:
+    CAssert(isOrphanedDatabase(@"channel-uninstalled", live));
+    CAssert(isOrphanedDatabase(@"channel-uninstalled", [NSSet set]));
+}
+
+#endif
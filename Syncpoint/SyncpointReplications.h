@@ -0,0 +1,151 @@
+//
+//  SyncpointReplications.h
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+@class CouchDatabase, CouchPersistentReplication, SyncpointReplicationRegistry, SyncpointSyncMetrics;
+
+
+/** The pair of continuous replications (pull and push) between a local database and a remote one. */
+@interface SyncpointReplicationPair : NSObject
+
+- (id) initWithLocalDatabase: (CouchDatabase*)localDatabase
+                   remoteURL: (NSURL*)remoteURL;
+
+@property (readonly) CouchDatabase* localDatabase;
+@property (readonly) NSURL* remoteURL;
+
+/** The document ID of the installation these replications belong to, if any. */
+@property (copy) NSString* ownerID;
+
+/** Scheduling priority; pairs with higher values are started first. Defaults to 0. */
+@property NSInteger priority;
+
+@property (readonly) CouchPersistentReplication* pull;
+@property (readonly) CouchPersistentReplication* push;
+
+/** If YES, the replications aren't continuous: they run in one-shot bursts, started by the
+    registry. Must be set before the pair is started. */
+@property BOOL bursts;
+
+/** In burst mode, the number of changes made to the local database since the last burst. */
+@property (readonly) NSUInteger localChanges;
+
+/** Statistics about the pull and push. */
+@property (readonly) SyncpointSyncMetrics* metrics;
+
+/** Have the replications been started (and not stopped since)? */
+@property (readonly) BOOL started;
+
+/** Have the replications caught up with the remote database since they were started?
+    (Or given up trying, because of an error or being offline.) */
+@property (readonly) BOOL caughtUp;
+
+/** Creates the replications, or does nothing if they're already running. */
+- (void) start;
+
+/** Stops and deletes the replications. */
+- (void) stop;
+
+@end
+
+
+@interface SyncpointReplicationPair (Subclassing)
+/** Creates and starts the underlying replications. Called by -start. */
+- (void) startReplications;
+/** Stops and deletes the underlying replications. Called by -stop. */
+- (void) stopReplications;
+/** Should be called when the replications have caught up, to free up a scheduling slot. */
+- (void) replicationsCaughtUp;
+@end
+
+
+
+/** Keeps track of the replications a SyncpointClient has started, keyed by (local db, remote URL),
+    so that asking to sync the same pair of databases again doesn't restart or reconfigure them.
+    It also limits how many pairs can be catching up at once: the rest wait in a queue, and are
+    started in priority order as earlier ones catch up. */
+@interface SyncpointReplicationRegistry : NSObject
+
+/** Starts replication between the two databases, unless it's already running or queued.
+    @return  The (new or existing) replication pair. */
+- (SyncpointReplicationPair*) startReplicationOf: (CouchDatabase*)localDatabase
+                                            with: (NSURL*)remoteURL
+                                         ownerID: (NSString*)ownerID
+                                        priority: (NSInteger)priority;
+
+/** Like -startReplicationOf:with:ownerID:priority:, but the pair can be put in burst mode: after
+    its first sync it sleeps, and is woken every burstInterval seconds, along with all the other
+    burst-mode pairs, to sync again in one shot. */
+- (SyncpointReplicationPair*) startReplicationOf: (CouchDatabase*)localDatabase
+                                            with: (NSURL*)remoteURL
+                                         ownerID: (NSString*)ownerID
+                                        priority: (NSInteger)priority
+                                          bursts: (BOOL)bursts;
+
+/** Changes the priority of the replications belonging to an installation document. */
+- (void) setPriority: (NSInteger)priority forOwnerID: (NSString*)ownerID;
+
+/** Returns the replication pair belonging to the given installation document, if any. */
+- (SyncpointReplicationPair*) pairWithOwnerID: (NSString*)ownerID;
+
+/** Stops and forgets all replications belonging to the given installation document. */
+- (void) stopReplicationsWithOwnerID: (NSString*)ownerID;
+
+/** Stops and forgets all replications. */
+- (void) stopAll;
+
+/** Stops all the replications without forgetting them, e.g. while the server is unreachable.
+    They go back in the queue, and nothing is started until -resumeWithStagger: is called. */
+- (void) suspend;
+
+/** Restarts the queued replications after -suspend, in priority order, waiting 'stagger' seconds
+    between starting one pair and the next so they don't all reconnect at the same moment. */
+- (void) resumeWithStagger: (NSTimeInterval)stagger;
+
+/** Is the registry suspended? */
+@property (readonly) BOOL suspended;
+
+/** Seconds between bursts. Bursts happen at multiples of this on the wall clock, so they line up
+    across pairs. Defaults to 15 minutes. */
+@property NSTimeInterval burstInterval;
+
+/** When this many local changes have been made to a burst-mode pair's database, the burst
+    happens right away instead of at the next interval. Defaults to 50. */
+@property NSUInteger burstChangeThreshold;
+
+/** Starts a burst now: all sleeping burst-mode pairs sync. */
+- (void) burstNow;
+
+/** The number of bursts so far. */
+@property (readonly) NSUInteger burstCount;
+
+/** The number of burst-mode pairs sleeping till the next burst. */
+@property (readonly) NSUInteger dormantCount;
+
+/** Called when one of a pair's replications reports an error or goes offline. */
+@property (copy) void (^onFailure)(SyncpointReplicationPair* pair);
+
+/** The maximum number of pairs that can be catching up at once. Defaults to 4. */
+@property NSUInteger maxActive;
+
+/** All currently registered replication pairs. */
+@property (readonly) NSArray* allPairs;
+
+/** The number of pairs started but not yet caught up. Never exceeds maxActive. */
+@property (readonly) NSUInteger activeCount;
+
+/** The number of pairs waiting for a slot. */
+@property (readonly) NSUInteger pendingCount;
+
+/** The number of start requests that were ignored because the replications were already running. */
+@property (readonly) NSUInteger redundantStartCount;
+
+/** The class of pair objects to create. Defaults to SyncpointReplicationPair; tests override it. */
+@property Class pairClass;
+
+@end
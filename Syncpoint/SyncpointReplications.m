@@ -0,0 +1,666 @@
+//
+//  SyncpointReplications.m
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import "SyncpointReplications.h"
+#import "SyncpointSyncMetrics.h"
+#import "SyncpointTrace.h"
+#import "CouchCocoa.h"
+
+
+#define kDefaultMaxActive 4
+
+#define kDefaultBurstInterval (15*60.0)
+#define kDefaultBurstChangeThreshold 50
+
+
+@interface SyncpointReplicationRegistry ()
+- (void) pairCaughtUp: (SyncpointReplicationPair*)pair;
+- (void) pairFailed: (SyncpointReplicationPair*)pair;
+- (void) pairHasLocalChanges: (SyncpointReplicationPair*)pair;
+- (void) watchLocalChangesOf: (CouchDatabase*)localDatabase;
+@end
+
+
+@interface SyncpointReplicationPair ()
+@property (weak) SyncpointReplicationRegistry* registry;
+- (void) localChangeMade;
+@end
+
+
+@implementation SyncpointReplicationPair
+{
+    CouchDatabase* _localDatabase;
+    NSURL* _remoteURL;
+    NSString* _ownerID;
+    NSInteger _priority;
+    __weak SyncpointReplicationRegistry* _registry;
+    CouchPersistentReplication *_pull, *_push;
+    SyncpointSyncMetrics* _metrics;
+    BOOL _started, _caughtUp, _failed;
+    BOOL _bursts;
+    NSUInteger _localChanges;
+}
+
+
+@synthesize localDatabase=_localDatabase, remoteURL=_remoteURL, ownerID=_ownerID,
+            priority=_priority, registry=_registry, pull=_pull, push=_push, metrics=_metrics,
+            started=_started, caughtUp=_caughtUp, bursts=_bursts, localChanges=_localChanges;
+
+
+static NSArray* observedKeys(void) {
+    return $array(@"mode", @"state");
+}
+
+
+- (id) initWithLocalDatabase: (CouchDatabase*)localDatabase
+                   remoteURL: (NSURL*)remoteURL
+{
+    self = [super init];
+    if (self) {
+        _localDatabase = localDatabase;
+        _remoteURL = remoteURL;
+        _metrics = [[SyncpointSyncMetrics alloc] init];
+    }
+    return self;
+}
+
+
+- (void) dealloc {
+    // Leave the persistent replications running, but stop observing them:
+    for (NSString* key in observedKeys()) {
+        [_pull removeObserver: self forKeyPath: key];
+        [_push removeObserver: self forKeyPath: key];
+    }
+}
+
+
+- (NSString*) description {
+    return $sprintf(@"%@[%@ <-> %@]", [self class], _localDatabase.relativePath, _remoteURL);
+}
+
+
+- (void) start {
+    if (_started)
+        return;
+    LogTo(Syncpoint, @"Starting replications of %@", self);
+    SyncpointTrace(kSyncpointTraceReplicationStart, (uint32_t)_localDatabase.relativePath.hash);
+    _started = YES;
+    _caughtUp = NO;
+    _failed = NO;
+    [self startReplications];
+}
+
+
+- (void) stop {
+    if (!_started)
+        return;
+    LogTo(Syncpoint, @"Stopping replications of %@", self);
+    SyncpointTrace(kSyncpointTraceReplicationStop, (uint32_t)_localDatabase.relativePath.hash);
+    _started = NO;
+    [self stopReplications];
+}
+
+
+- (void) startReplications {
+    NSArray* repls = [_localDatabase replicateWithURL: _remoteURL exclusively: NO];
+    _pull = [repls objectAtIndex: 0];
+    _push = [repls objectAtIndex: 1];
+    // In burst mode the replications are one-shot, and are started again for each burst:
+    _pull.continuous = !_bursts;
+    _push.continuous = !_bursts;
+    for (NSString* key in observedKeys()) {
+        [_pull addObserver: self forKeyPath: key options: 0 context: NULL];
+        [_push addObserver: self forKeyPath: key options: 0 context: NULL];
+    }
+    [_metrics observeReplication: _pull];
+    [_metrics observeReplication: _push];
+    if (_bursts) {
+        // Count the changes made to the local database between bursts, so that a burst can be
+        // triggered early when enough of them pile up:
+        _localChanges = 0;
+        [_registry watchLocalChangesOf: _localDatabase];
+    }
+    // Existing replications may already be caught up, in which case they won't notify us:
+    [self updateStatus];
+}
+
+
+- (void) localChangeMade {
+    if (!_bursts)
+        return;
+    ++_localChanges;
+    [_registry pairHasLocalChanges: self];
+}
+
+
+- (void) stopReplications {
+    if (!_pull)
+        return;
+    for (NSString* key in observedKeys()) {
+        [_pull removeObserver: self forKeyPath: key];
+        [_push removeObserver: self forKeyPath: key];
+    }
+    [_metrics stopObservingReplication: _pull];
+    [_metrics stopObservingReplication: _push];
+    [_pull deleteDocument];
+    [_push deleteDocument];
+    _pull = _push = nil;
+}
+
+
+static BOOL replicationFailed(CouchPersistentReplication* repl) {
+    return repl.mode == kCouchReplicationOffline || repl.error != nil;
+}
+
+static BOOL replicationCaughtUp(CouchPersistentReplication* repl) {
+    return repl.mode == kCouchReplicationIdle || replicationFailed(repl);
+}
+
+// (For a one-shot replication, in burst mode.)
+static BOOL replicationFinished(CouchPersistentReplication* repl) {
+    CouchReplicationState state = repl.state;
+    return state == kReplicationCompleted || state == kReplicationError || replicationFailed(repl);
+}
+
+
+- (void) observeValueForKeyPath: (NSString*)keyPath ofObject: (id)object
+                         change: (NSDictionary*)change context: (void*)context
+{
+    [self updateStatus];
+}
+
+
+- (void) updateStatus {
+    if (!_started || !_pull)
+        return;
+    BOOL failed = replicationFailed(_pull) || replicationFailed(_push);
+    if (failed && !_failed)
+        [_registry pairFailed: self];
+    _failed = failed;
+    if (_caughtUp)
+        return;
+    if (_bursts ? (replicationFinished(_pull) && replicationFinished(_push))
+                : (replicationCaughtUp(_pull) && replicationCaughtUp(_push)))
+        [self replicationsCaughtUp];
+}
+
+
+- (void) replicationsCaughtUp {
+    if (_caughtUp || !_started)
+        return;
+    LogTo(Syncpoint, @"Caught up: %@", self);
+    _caughtUp = YES;
+    [_registry pairCaughtUp: self];
+}
+
+
+@end
+
+
+
+
+@implementation SyncpointReplicationRegistry
+{
+    NSMutableDictionary* _pairs;        // key string -> SyncpointReplicationPair
+    NSMutableArray* _pending;           // pairs waiting to be started, in request order
+    NSMutableSet* _active;              // pairs started but not yet caught up
+    NSUInteger _maxActive;
+    NSUInteger _redundantStartCount;
+    Class _pairClass;
+    BOOL _suspended;
+    NSTimeInterval _stagger;            // delay between starts while resuming; else 0
+    BOOL _staggeredStartScheduled;
+    void (^_onFailure)(SyncpointReplicationPair*);
+    NSMutableSet* _dormant;             // burst-mode pairs waiting for the next burst
+    NSTimeInterval _burstInterval;
+    NSUInteger _burstChangeThreshold;
+    BOOL _burstScheduled;
+    NSUInteger _burstCount;
+    NSMutableSet* _watchedDatabases;    // names of local DBs whose changes are routed to pairs
+}
+
+
+@synthesize maxActive=_maxActive, redundantStartCount=_redundantStartCount, pairClass=_pairClass,
+            suspended=_suspended, onFailure=_onFailure,
+            burstChangeThreshold=_burstChangeThreshold, burstCount=_burstCount;
+
+
+- (id) init {
+    self = [super init];
+    if (self) {
+        _pairs = [[NSMutableDictionary alloc] init];
+        _pending = [[NSMutableArray alloc] init];
+        _active = [[NSMutableSet alloc] init];
+        _dormant = [[NSMutableSet alloc] init];
+        _watchedDatabases = [[NSMutableSet alloc] init];
+        _maxActive = kDefaultMaxActive;
+        _burstInterval = kDefaultBurstInterval;
+        _burstChangeThreshold = kDefaultBurstChangeThreshold;
+        _pairClass = [SyncpointReplicationPair class];
+    }
+    return self;
+}
+
+
+- (void) dealloc {
+    [NSObject cancelPreviousPerformRequestsWithTarget: self];
+}
+
+
+static NSString* keyFor(CouchDatabase* localDatabase, NSURL* remoteURL) {
+    return $sprintf(@"%@ %@", localDatabase.relativePath, remoteURL.absoluteString);
+}
+
+
+- (SyncpointReplicationPair*) startReplicationOf: (CouchDatabase*)localDatabase
+                                            with: (NSURL*)remoteURL
+                                         ownerID: (NSString*)ownerID
+                                        priority: (NSInteger)priority
+{
+    return [self startReplicationOf: localDatabase with: remoteURL ownerID: ownerID
+                           priority: priority bursts: NO];
+}
+
+
+- (SyncpointReplicationPair*) startReplicationOf: (CouchDatabase*)localDatabase
+                                            with: (NSURL*)remoteURL
+                                         ownerID: (NSString*)ownerID
+                                        priority: (NSInteger)priority
+                                          bursts: (BOOL)bursts
+{
+    NSString* key = keyFor(localDatabase, remoteURL);
+    SyncpointReplicationPair* pair = [_pairs objectForKey: key];
+    if (pair && pair.bursts != bursts) {
+        // Switching sync modes; replace the pair with one in the new mode:
+        LogTo(Syncpoint, @"Switching %@ to %@ sync", pair, (bursts ? @"burst" : @"continuous"));
+        [self forgetPair: pair forKey: key];
+        pair = nil;
+    }
+    if (pair) {
+        ++_redundantStartCount;
+        LogTo(SyncpointVerbose, @"Already replicating %@ (%u redundant starts)",
+              pair, (unsigned)_redundantStartCount);
+        return pair;
+    }
+    pair = [[_pairClass alloc] initWithLocalDatabase: localDatabase remoteURL: remoteURL];
+    pair.ownerID = ownerID;
+    pair.priority = priority;
+    pair.bursts = bursts;
+    pair.registry = self;
+    [_pairs setObject: pair forKey: key];
+    [_pending addObject: pair];
+    [self schedule];
+    if (bursts)
+        [self scheduleBurst];
+    return pair;
+}
+
+
+- (void) setPriority: (NSInteger)priority forOwnerID: (NSString*)ownerID {
+    for (SyncpointReplicationPair* pair in _pairs.objectEnumerator)
+        if ([pair.ownerID isEqualToString: ownerID])
+            pair.priority = priority;
+}
+
+
+// Starts the highest-priority pending pairs, as long as there are free slots.
+// (While resuming, only one is started at a time, and the rest after a delay.)
+- (void) schedule {
+    if (_suspended || _staggeredStartScheduled)
+        return;
+    while (_active.count < _maxActive && _pending.count > 0) {
+        SyncpointReplicationPair* next = nil;
+        for (SyncpointReplicationPair* pair in _pending)
+            if (!next || pair.priority > next.priority)
+                next = pair;
+        [_pending removeObjectIdenticalTo: next];
+        [_active addObject: next];
+        [next start];
+        if (_stagger > 0 && _pending.count > 0) {
+            _staggeredStartScheduled = YES;
+            [self performSelector: @selector(staggeredSchedule) withObject: nil
+                       afterDelay: _stagger];
+            break;
+        }
+    }
+    if (_pending.count == 0)
+        _stagger = 0;
+    LogTo(SyncpointVerbose, @"Scheduler: %u active, %u pending",
+          (unsigned)_active.count, (unsigned)_pending.count);
+}
+
+
+- (void) staggeredSchedule {
+    _staggeredStartScheduled = NO;
+    [self schedule];
+}
+
+
+- (void) pairCaughtUp: (SyncpointReplicationPair*)pair {
+    if ([_active containsObject: pair]) {
+        [_active removeObject: pair];
+        if (pair.bursts) {
+            // The burst is over; put the pair to sleep till the next one:
+            [pair stop];
+            [_dormant addObject: pair];
+        }
+        [self schedule];
+    }
+}
+
+
+- (void) pairFailed: (SyncpointReplicationPair*)pair {
+    LogTo(Syncpoint, @"Replications failed: %@", pair);
+    if (_onFailure)
+        _onFailure(pair);
+}
+
+
+- (void) forgetPair: (SyncpointReplicationPair*)pair forKey: (NSString*)key {
+    [pair stop];
+    [_pending removeObjectIdenticalTo: pair];
+    [_active removeObject: pair];
+    [_dormant removeObject: pair];
+    [_pairs removeObjectForKey: key];
+}
+
+
+- (SyncpointReplicationPair*) pairWithOwnerID: (NSString*)ownerID {
+    for (SyncpointReplicationPair* pair in _pairs.objectEnumerator)
+        if ([pair.ownerID isEqualToString: ownerID])
+            return pair;
+    return nil;
+}
+
+
+- (void) stopReplicationsWithOwnerID: (NSString*)ownerID {
+    for (NSString* key in _pairs.allKeys) {
+        SyncpointReplicationPair* pair = [_pairs objectForKey: key];
+        if ([pair.ownerID isEqualToString: ownerID])
+            [self forgetPair: pair forKey: key];
+    }
+    [self schedule];
+}
+
+
+- (void) stopAll {
+    for (SyncpointReplicationPair* pair in _pairs.objectEnumerator)
+        [pair stop];
+    [_pairs removeAllObjects];
+    [_pending removeAllObjects];
+    [_active removeAllObjects];
+    [_dormant removeAllObjects];
+}
+
+
+- (void) suspend {
+    if (_suspended)
+        return;
+    LogTo(Syncpoint, @"Suspending %u replication pairs", (unsigned)_pairs.count);
+    _suspended = YES;
+    [NSObject cancelPreviousPerformRequestsWithTarget: self selector: @selector(staggeredSchedule)
+                                               object: nil];
+    _staggeredStartScheduled = NO;
+    for (SyncpointReplicationPair* pair in _pairs.objectEnumerator) {
+        if (pair.started) {
+            [pair stop];
+            [_pending addObject: pair];
+        }
+    }
+    [_active removeAllObjects];
+}
+
+
+- (void) resumeWithStagger: (NSTimeInterval)stagger {
+    if (!_suspended)
+        return;
+    LogTo(Syncpoint, @"Resuming %u replication pairs", (unsigned)_pending.count);
+    _suspended = NO;
+    _stagger = stagger;
+    [self schedule];
+}
+
+
+#pragma mark - BURSTS:
+
+
+// Schedules the next burst. Bursts happen at multiples of the interval on the wall clock, so all
+// burst-mode pairs (even those of other registries) sync at the same moments and the radio only
+// has to wake up once for all of them.
+- (void) scheduleBurst {
+    if (_burstScheduled || _burstInterval <= 0)
+        return;
+    _burstScheduled = YES;
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    NSTimeInterval delay = (floor(now / _burstInterval) + 1) * _burstInterval - now;
+    [self performSelector: @selector(burstTimerFired) withObject: nil afterDelay: delay];
+}
+
+
+- (NSTimeInterval) burstInterval {
+    return _burstInterval;
+}
+
+- (void) setBurstInterval: (NSTimeInterval)burstInterval {
+    _burstInterval = burstInterval;
+    if (_burstScheduled) {
+        [NSObject cancelPreviousPerformRequestsWithTarget: self selector: @selector(burstTimerFired)
+                                                   object: nil];
+        _burstScheduled = NO;
+        [self scheduleBurst];
+    }
+}
+
+
+- (void) burstTimerFired {
+    _burstScheduled = NO;
+    [self burstNow];
+    for (SyncpointReplicationPair* pair in _pairs.objectEnumerator) {
+        if (pair.bursts) {
+            [self scheduleBurst];
+            break;
+        }
+    }
+}
+
+
+- (void) burstNow {
+    if (_suspended || _dormant.count == 0)
+        return;
+    ++_burstCount;
+    LogTo(Syncpoint, @"Burst #%u: syncing %u pairs",
+          (unsigned)_burstCount, (unsigned)_dormant.count);
+    SyncpointTrace(kSyncpointTraceBurst, (uint32_t)_dormant.count);
+    [_pending addObjectsFromArray: _dormant.allObjects];
+    [_dormant removeAllObjects];
+    [self schedule];
+}
+
+
+// Called when a change is made to a burst-mode pair's local database. If enough have piled up,
+// all the dormant pairs burst now, so they still share one wakeup.
+- (void) pairHasLocalChanges: (SyncpointReplicationPair*)pair {
+    if (pair.localChanges >= _burstChangeThreshold && [_dormant containsObject: pair]) {
+        LogTo(Syncpoint, @"%u local changes to %@; bursting early",
+              (unsigned)pair.localChanges, pair);
+        [self burstNow];
+    }
+}
+
+
+// Routes the local changes to a database to its burst-mode pairs. A database can't forget an
+// onChange: block, so there's only ever one per database, however often its pairs are replaced.
+- (void) watchLocalChangesOf: (CouchDatabase*)localDatabase {
+    NSString* dbName = localDatabase.relativePath;
+    if ([_watchedDatabases containsObject: dbName])
+        return;
+    [_watchedDatabases addObject: dbName];
+    __weak SyncpointReplicationRegistry* weakSelf = self;
+    [localDatabase onChange: ^(CouchDocument* doc, BOOL externalChange) {
+        if (!externalChange)        // (changes made by the replicator are external)
+            [weakSelf localChangeMadeInDatabaseNamed: dbName];
+    }];
+    localDatabase.tracksChanges = YES;
+}
+
+
+- (void) localChangeMadeInDatabaseNamed: (NSString*)dbName {
+    for (SyncpointReplicationPair* pair in _pairs.allValues)
+        if ([pair.localDatabase.relativePath isEqualToString: dbName])
+            [pair localChangeMade];
+}
+
+
+- (NSUInteger) dormantCount {
+    return _dormant.count;
+}
+
+
+- (NSArray*) allPairs {
+    return _pairs.allValues;
+}
+
+
+- (NSUInteger) activeCount {
+    return _active.count;
+}
+
+
+- (NSUInteger) pendingCount {
+    return _pending.count;
+}
+
+
+@end
+
+
+
+
+#pragma mark - TESTS:
+#if DEBUG
+
+
+// Stand-in for a replication pair that doesn't touch any database.
+@interface FakeReplicationPair : SyncpointReplicationPair
+@end
+
+@implementation FakeReplicationPair
+- (void) startReplications { }
+- (void) stopReplications { }
+@end
+
+
+TestCase(SyncpointReplicationScheduler) {
+    SyncpointReplicationRegistry* registry = [[SyncpointReplicationRegistry alloc] init];
+    registry.pairClass = [FakeReplicationPair class];
+    registry.maxActive = 3;
+
+    // Queue up a bunch of synthetic installations, one of them high-priority:
+    const NSUInteger kNumInstallations = 50;
+    NSMutableArray* pairs = $marray();
+    for (NSUInteger i = 0; i < kNumInstallations; ++i) {
+        NSURL* remote = [NSURL URLWithString: $sprintf(@"http://example.com/channel-%u", (unsigned)i)];
+        NSString* ownerID = $sprintf(@"inst-%u", (unsigned)i);
+        [pairs addObject: [registry startReplicationOf: nil with: remote ownerID: ownerID
+                                              priority: (i == 40 ? 10 : 0)]];
+    }
+    CAssertEq(registry.activeCount, 3u);
+    CAssertEq(registry.pendingCount, kNumInstallations - 3);
+
+    // Asking again for a running pair is a no-op:
+    [registry startReplicationOf: nil with: [NSURL URLWithString: @"http://example.com/channel-0"]
+                         ownerID: @"inst-0" priority: 0];
+    CAssertEq(registry.redundantStartCount, 1u);
+    CAssertEq(registry.activeCount, 3u);
+
+    // The high-priority pair gets the next free slot:
+    [[pairs objectAtIndex: 0] replicationsCaughtUp];
+    CAssert([[pairs objectAtIndex: 40] started]);
+    CAssertEq(registry.activeCount, 3u);
+
+    // Let everything catch up, checking that the limit is never exceeded:
+    NSUInteger caughtUp = 1;
+    while (registry.activeCount > 0) {
+        for (SyncpointReplicationPair* pair in pairs) {
+            if (pair.started && !pair.caughtUp) {
+                [pair replicationsCaughtUp];
+                ++caughtUp;
+                break;
+            }
+        }
+        CAssert(registry.activeCount <= 3u);
+    }
+    CAssertEq(caughtUp, kNumInstallations);
+    CAssertEq(registry.pendingCount, 0u);
+
+    // Uninstalling stops and forgets the pair:
+    [registry stopReplicationsWithOwnerID: @"inst-7"];
+    CAssert(![[pairs objectAtIndex: 7] started]);
+    CAssertEq(registry.allPairs.count, kNumInstallations - 1);
+
+    // Suspending stops everything but remembers it; resuming restarts up to the limit:
+    [registry suspend];
+    CAssertEq(registry.activeCount, 0u);
+    CAssertEq(registry.pendingCount, kNumInstallations - 1);
+    CAssert(![[pairs objectAtIndex: 0] started]);
+    [registry startReplicationOf: nil with: [NSURL URLWithString: @"http://example.com/channel-7"]
+                         ownerID: @"inst-7" priority: 0];
+    CAssertEq(registry.activeCount, 0u);
+    [registry resumeWithStagger: 0.0];
+    CAssertEq(registry.activeCount, 3u);
+    CAssert([[pairs objectAtIndex: 40] started]);
+}
+
+
+TestCase(SyncpointReplicationBursts) {
+    SyncpointReplicationRegistry* registry = [[SyncpointReplicationRegistry alloc] init];
+    registry.pairClass = [FakeReplicationPair class];
+    NSMutableArray* pairs = $marray();
+    for (NSUInteger i = 0; i < 3; ++i) {
+        NSURL* remote = [NSURL URLWithString: $sprintf(@"http://example.com/channel-%u", (unsigned)i)];
+        [pairs addObject: [registry startReplicationOf: nil with: remote
+                                               ownerID: $sprintf(@"inst-%u", (unsigned)i)
+                                              priority: 0 bursts: (i < 2)]];
+    }
+    CAssertEq(registry.activeCount, 3u);
+
+    // After the initial sync, burst-mode pairs stop and wait; continuous ones keep running:
+    for (SyncpointReplicationPair* pair in pairs)
+        [pair replicationsCaughtUp];
+    CAssertEq(registry.activeCount, 0u);
+    CAssertEq(registry.dormantCount, 2u);
+    CAssert(![[pairs objectAtIndex: 0] started]);
+    CAssert([[pairs objectAtIndex: 2] started]);
+
+    // A burst wakes them all up together:
+    [registry burstNow];
+    CAssertEq(registry.burstCount, 1u);
+    CAssertEq(registry.activeCount, 2u);
+    CAssertEq(registry.dormantCount, 0u);
+    for (SyncpointReplicationPair* pair in pairs)
+        [pair replicationsCaughtUp];
+    CAssertEq(registry.dormantCount, 2u);
+
+    // No bursts while suspended:
+    [registry suspend];
+    [registry burstNow];
+    CAssertEq(registry.burstCount, 1u);
+    [registry resumeWithStagger: 0.0];
+
+    // Switching modes replaces the pair:
+    SyncpointReplicationPair* pair = [registry startReplicationOf: nil
+                                  with: [NSURL URLWithString: @"http://example.com/channel-0"]
+                               ownerID: @"inst-0" priority: 0 bursts: NO];
+    CAssert(pair != [pairs objectAtIndex: 0]);
+    CAssert(!pair.bursts);
+    CAssertEq(registry.dormantCount, 1u);
+    CAssertEq(registry.allPairs.count, 3u);
+}
+
+
+#endif
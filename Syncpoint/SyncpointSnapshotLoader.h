@@ -0,0 +1,46 @@
+//
+//  SyncpointSnapshotLoader.h
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+@class CouchDatabase;
+
+
+typedef void (^SyncpointSnapshotBlock)(NSError* error);
+
+
+/** Bootstraps a new local channel database from a snapshot of its cloud database, instead of
+    replicating it document by document.
+    The snapshot is a compacted TouchDB database file, which the server makes by pulling from the
+    cloud database at the same URL the client replicates with. Since the file carries that
+    replication's checkpoint, a pull started after the snapshot is installed resumes from where
+    the snapshot left off instead of starting over.
+    The file is streamed to disk, then swapped in as the local database. This only works with an
+    embedded TouchDB server. */
+@interface SyncpointSnapshotLoader : NSObject
+
+- (id) initWithSnapshotURL: (NSURL*)snapshotURL
+             localDatabase: (CouchDatabase*)localDatabase;
+
+@property (readonly) NSURL* snapshotURL;
+@property (readonly) CouchDatabase* localDatabase;
+
+/** Starts the download. onComplete is called on the main thread when the snapshot has been
+    installed, or with an error if it failed (in which case the local database is untouched.) */
+- (void) start: (SyncpointSnapshotBlock)onComplete;
+
+/** Cancels the download, if it's still in progress. onComplete won't be called, even if the
+    download has already finished and the snapshot is being installed. */
+- (void) cancel;
+
+/** Number of bytes of the snapshot downloaded so far. */
+@property (readonly) UInt64 bytesReceived;
+
+/** Total size of the snapshot, if the server reported it; else 0. */
+@property (readonly) UInt64 expectedBytes;
+
+@end
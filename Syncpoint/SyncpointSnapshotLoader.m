@@ -0,0 +1,154 @@
+//
+//  SyncpointSnapshotLoader.m
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import "SyncpointSnapshotLoader.h"
+#import "CouchCocoa.h"
+#import "CouchTouchDBServer.h"
+#import "TDDatabase.h"
+
+
+@interface SyncpointSnapshotLoader () <NSURLConnectionDataDelegate>
+- (void) finishWithError: (NSError*)error;
+@end
+
+
+@implementation SyncpointSnapshotLoader
+{
+    NSURL* _snapshotURL;
+    CouchDatabase* _localDatabase;
+    NSURLConnection* _connection;
+    NSString* _tempPath;
+    NSFileHandle* _file;
+    SyncpointSnapshotBlock _onComplete;
+    UInt64 _bytesReceived, _expectedBytes;
+    BOOL _cancelled;
+}
+
+
+@synthesize snapshotURL=_snapshotURL, localDatabase=_localDatabase,
+            bytesReceived=_bytesReceived, expectedBytes=_expectedBytes;
+
+
+- (id) initWithSnapshotURL: (NSURL*)snapshotURL
+             localDatabase: (CouchDatabase*)localDatabase
+{
+    self = [super init];
+    if (self) {
+        _snapshotURL = snapshotURL;
+        _localDatabase = localDatabase;
+    }
+    return self;
+}
+
+
+- (void) dealloc {
+    [self cancel];
+}
+
+
+- (void) start: (SyncpointSnapshotBlock)onComplete {
+    Assert(!_connection);
+    _onComplete = [onComplete copy];
+    _tempPath = [NSTemporaryDirectory() stringByAppendingPathComponent:
+                        $sprintf(@"syncpoint-snapshot-%@.touchdb", [[NSProcessInfo processInfo] globallyUniqueString])];
+    if (![[NSFileManager defaultManager] createFileAtPath: _tempPath contents: nil attributes: nil]) {
+        [self finishWithError: [NSError errorWithDomain: NSPOSIXErrorDomain code: errno
+                                               userInfo: nil]];
+        return;
+    }
+    _file = [NSFileHandle fileHandleForWritingAtPath: _tempPath];
+    LogTo(Syncpoint, @"Downloading snapshot %@ for %@", _snapshotURL, _localDatabase);
+    NSURLRequest* request = [NSURLRequest requestWithURL: _snapshotURL];
+    _connection = [[NSURLConnection alloc] initWithRequest: request delegate: self];
+}
+
+
+- (void) cancel {
+    // Once the download has finished, the snapshot may be being installed, which can't be
+    // interrupted; but onComplete still mustn't be called.
+    _cancelled = YES;
+    _onComplete = nil;
+    if (_connection) {
+        [_connection cancel];
+        _connection = nil;
+        [self finishWithError: nil];
+    }
+}
+
+
+- (void) finishWithError: (NSError*)error {
+    [_file closeFile];
+    _file = nil;
+    _connection = nil;
+    if (_tempPath) {
+        [[NSFileManager defaultManager] removeItemAtPath: _tempPath error: NULL];
+        _tempPath = nil;
+    }
+    SyncpointSnapshotBlock onComplete = _cancelled ? nil : _onComplete;
+    _onComplete = nil;
+    if (error && !_cancelled)
+        Warn(@"SyncpointSnapshotLoader: failed to load %@: %@", _snapshotURL, error);
+    if (onComplete)
+        onComplete(error);
+}
+
+
+#pragma mark - DOWNLOADING:
+
+
+- (void)connection: (NSURLConnection*)connection didReceiveResponse: (NSURLResponse*)response {
+    NSInteger status = [response isKindOfClass: [NSHTTPURLResponse class]]
+                            ? ((NSHTTPURLResponse*)response).statusCode : 200;
+    if (status >= 300) {
+        [connection cancel];
+        [self finishWithError: [NSError errorWithDomain: @"HTTP" code: status userInfo: nil]];
+        return;
+    }
+    long long length = response.expectedContentLength;
+    _expectedBytes = length > 0 ? length : 0;
+}
+
+
+- (void)connection: (NSURLConnection*)connection didReceiveData: (NSData*)data {
+    // Stream straight to disk; the snapshot may be far too big to hold in memory.
+    [_file writeData: data];
+    _bytesReceived += data.length;
+}
+
+
+- (void)connection: (NSURLConnection*)connection didFailWithError: (NSError*)error {
+    [self finishWithError: error];
+}
+
+
+- (void)connectionDidFinishLoading: (NSURLConnection*)connection {
+    [_file closeFile];
+    _file = nil;
+    _connection = nil;
+    LogTo(Syncpoint, @"Downloaded snapshot (%llu bytes); installing as %@",
+          _bytesReceived, _localDatabase.relativePath);
+
+    CouchTouchDBServer* server = $castIf(CouchTouchDBServer, _localDatabase.server);
+    if (!server) {
+        [self finishWithError: [NSError errorWithDomain: NSCocoaErrorDomain
+                                                   code: NSFeatureUnsupportedError
+                                               userInfo: nil]];
+        return;
+    }
+    NSString* path = _tempPath;
+    [server tellTDDatabaseNamed: _localDatabase.relativePath to: ^(TDDatabase* tddb) {
+        NSError* error = nil;
+        BOOL ok = [tddb replaceWithDatabaseFile: path withAttachments: nil error: &error];
+        dispatch_async(dispatch_get_main_queue(), ^{
+            [self finishWithError: (ok ? nil : error)];
+        });
+    }];
+}
+
+
+@end
@@ -0,0 +1,52 @@
+//
+//  SyncpointSyncMetrics.h
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+
+/** Running statistics about a set of replications (e.g. the pull and push of one installation.)
+    The values are updated as the replications report progress, so reading them is cheap enough
+    to do on every UI refresh. */
+@interface SyncpointSyncMetrics : NSObject
+
+/** Starts/stops collecting statistics from a replication (a CouchReplication or CouchPersistentReplication.) */
+- (void) observeReplication: (id)replication;
+- (void) stopObservingReplication: (id)replication;
+
+/** Recent throughput, in documents per second (exponentially smoothed.) */
+@property (readonly) double docsPerSecond;
+
+/** Total number of documents transferred since the metrics were created. */
+@property (readonly) NSUInteger docsTransferred;
+
+/** Number of changes the replications know about but haven't transferred yet. These count
+    changed documents, as the replicators report them, not sequence numbers. */
+@property (readonly) NSUInteger lag;
+
+/** The last time all the replications were idle (caught up) or, if one-shot, finished; or nil if
+    they never have been. */
+@property (readonly) NSDate* lastSyncTime;
+
+/** Seconds since lastSyncTime, or -1 if never synced. */
+@property (readonly) NSTimeInterval timeSinceLastSync;
+
+/** Number of times the replications have gone from quiet to transferring data, each of which
+    costs a wakeup of the radio. */
+@property (readonly) NSUInteger wakeCount;
+
+/** wakeCount, and docsTransferred, averaged per hour since the metrics were created. */
+@property (readonly) double wakeupsPerHour;
+@property (readonly) double docsPerHour;
+
+/** Number of times a replication has reported an error. */
+@property (readonly) NSUInteger errorCount;
+
+/** The values of all the above, as a JSON-compatible dictionary. */
+@property (readonly) NSDictionary* snapshot;
+
+@end
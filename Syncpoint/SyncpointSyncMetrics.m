@@ -0,0 +1,170 @@
+//
+//  SyncpointSyncMetrics.m
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import "SyncpointSyncMetrics.h"
+#import "CouchCocoa.h"
+
+
+// Weight given to the newest sample when smoothing docsPerSecond.
+#define kRateSmoothing 0.3
+
+
+@implementation SyncpointSyncMetrics
+{
+    NSMutableArray* _replications;
+    NSUInteger _lastCompleted;
+    CFAbsoluteTime _lastProgressTime;
+    double _docsPerSecond;
+    NSUInteger _docsTransferred;
+    NSDate* _lastSyncTime;
+    NSUInteger _errorCount;
+    CFAbsoluteTime _createdAt;
+    BOOL _transferring;
+    NSUInteger _wakeCount;
+}
+
+
+@synthesize docsPerSecond=_docsPerSecond, docsTransferred=_docsTransferred,
+            lastSyncTime=_lastSyncTime, errorCount=_errorCount, wakeCount=_wakeCount;
+
+
+static NSArray* observedKeys(void) {
+    return $array(@"completed", @"mode", @"error");
+}
+
+
+- (id) init {
+    self = [super init];
+    if (self) {
+        _replications = [[NSMutableArray alloc] init];
+        _createdAt = CFAbsoluteTimeGetCurrent();
+    }
+    return self;
+}
+
+
+- (void) dealloc {
+    for (id repl in _replications)
+        for (NSString* key in observedKeys())
+            [repl removeObserver: self forKeyPath: key];
+}
+
+
+- (void) observeReplication: (id)replication {
+    if (!replication || [_replications indexOfObjectIdenticalTo: replication] != NSNotFound)
+        return;
+    [_replications addObject: replication];
+    for (NSString* key in observedKeys())
+        [replication addObserver: self forKeyPath: key options: 0 context: NULL];
+    _lastCompleted = [self sumOfCompleted];
+}
+
+
+- (void) stopObservingReplication: (id)replication {
+    if (!replication || [_replications indexOfObjectIdenticalTo: replication] == NSNotFound)
+        return;
+    for (NSString* key in observedKeys())
+        [replication removeObserver: self forKeyPath: key];
+    [_replications removeObjectIdenticalTo: replication];
+    _lastCompleted = [self sumOfCompleted];
+}
+
+
+- (NSUInteger) sumOfCompleted {
+    NSUInteger completed = 0;
+    for (CouchReplication* repl in _replications)
+        completed += repl.completed;
+    return completed;
+}
+
+
+- (void) observeValueForKeyPath: (NSString*)keyPath ofObject: (id)object
+                         change: (NSDictionary*)change context: (void*)context
+{
+    if ([keyPath isEqualToString: @"completed"]) {
+        NSUInteger completed = [self sumOfCompleted];
+        CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+        if (completed > _lastCompleted) {
+            NSUInteger delta = completed - _lastCompleted;
+            _docsTransferred += delta;
+            if (_lastProgressTime > 0 && now > _lastProgressTime) {
+                double rate = delta / (now - _lastProgressTime);
+                _docsPerSecond = kRateSmoothing * rate + (1.0 - kRateSmoothing) * _docsPerSecond;
+            }
+        }
+        _lastCompleted = completed;     // (it goes down when a replication restarts)
+        _lastProgressTime = now;
+    } else if ([keyPath isEqualToString: @"mode"]) {
+        // Continuous replications are synced when idle; one-shot ones when they've stopped
+        // without an error. Each time one starts transferring counts as a wakeup:
+        BOOL transferring = NO, synced = YES;
+        for (CouchReplication* repl in _replications) {
+            CouchReplicationMode mode = repl.mode;
+            if (mode == kCouchReplicationActive)
+                transferring = YES;
+            BOOL finished = !repl.continuous && mode == kCouchReplicationStopped && !repl.error;
+            if (mode != kCouchReplicationIdle && !finished)
+                synced = NO;
+        }
+        if (transferring && !_transferring)
+            ++_wakeCount;
+        _transferring = transferring;
+        if (synced) {
+            _lastSyncTime = [NSDate date];
+            _docsPerSecond = 0.0;
+        }
+    } else if ([keyPath isEqualToString: @"error"]) {
+        if ([object error])
+            ++_errorCount;
+    }
+}
+
+
+- (NSUInteger) lag {
+    NSUInteger lag = 0;
+    for (CouchReplication* repl in _replications)
+        if (repl.total > repl.completed)
+            lag += repl.total - repl.completed;
+    return lag;
+}
+
+
+- (NSTimeInterval) timeSinceLastSync {
+    return _lastSyncTime ? -[_lastSyncTime timeIntervalSinceNow] : -1.0;
+}
+
+
+static double perHour(NSUInteger count, CFAbsoluteTime since) {
+    NSTimeInterval elapsed = CFAbsoluteTimeGetCurrent() - since;
+    return elapsed > 0 ? count * 3600.0 / elapsed : 0.0;
+}
+
+
+- (double) wakeupsPerHour {
+    return perHour(_wakeCount, _createdAt);
+}
+
+
+- (double) docsPerHour {
+    return perHour(_docsTransferred, _createdAt);
+}
+
+
+- (NSDictionary*) snapshot {
+    return $dict({@"docs_per_sec", [NSNumber numberWithDouble: _docsPerSecond]},
+                 {@"docs_transferred", [NSNumber numberWithUnsignedInteger: _docsTransferred]},
+                 {@"lag", [NSNumber numberWithUnsignedInteger: self.lag]},
+                 {@"time_since_sync", [NSNumber numberWithDouble: self.timeSinceLastSync]},
+                 {@"wakeups", [NSNumber numberWithUnsignedInteger: _wakeCount]},
+                 {@"wakeups_per_hour", [NSNumber numberWithDouble: self.wakeupsPerHour]},
+                 {@"docs_per_hour", [NSNumber numberWithDouble: self.docsPerHour]},
+                 {@"errors", [NSNumber numberWithUnsignedInteger: _errorCount]});
+}
+
+
+@end
@@ -0,0 +1,89 @@
+//
+//  SyncpointTrace.h
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+
+/** Always-on, low-overhead tracing of Syncpoint's hot paths.
+    Events are appended to a fixed-size, preallocated in-memory ring buffer as small binary
+    records: a timestamp, an event type, a phase and one integer argument. Nothing is formatted
+    or allocated when an event is recorded, so tracing can stay on in production builds; the
+    buffer just holds the most recent events. Call +[SyncpointTrace dumpToFile:error:] to save it,
+    then decode the dump offline (the Mac demo app does this with --decode-trace, or
+    --chrome-trace for chrome://tracing JSON.) */
+
+
+/** Types of traced events. These numbers appear in dumps, so don't renumber them. */
+typedef enum {
+    kSyncpointTraceStateChange = 1,     /**< Instant; arg is the new SyncpointState */
+    kSyncpointTraceChangeBatch,         /**< Begin/end; arg is the number of notifications merged */
+    kSyncpointTraceReconcile,           /**< Begin: arg is the number of changed docs; end: channels reconciled */
+    kSyncpointTraceGraphLoad,           /**< Begin/end of building a session's object graph */
+    kSyncpointTraceModelLookup,         /**< Instant; arg is 1 if the model was found, else 0 */
+    kSyncpointTraceSave,                /**< Begin/end; arg is the number of documents saved */
+    kSyncpointTraceReplicationStart,    /**< Instant; arg is a hash of the local database's name */
+    kSyncpointTraceReplicationStop,     /**< Instant; arg is a hash of the local database's name */
+    kSyncpointTraceServerLost,          /**< Instant */
+    kSyncpointTraceServerRegained,      /**< Instant */
+    kSyncpointTraceBurst,               /**< Instant; arg is the number of pairs syncing */
+    kSyncpointTraceNumEvents
+} SyncpointTraceEvent;
+
+typedef enum {
+    kSyncpointTraceInstant,
+    kSyncpointTraceBegin,
+    kSyncpointTraceEnd
+} SyncpointTracePhase;
+
+
+/** A record in the trace buffer, and in a dump. */
+typedef struct {
+    uint64_t time;          /**< mach_absolute_time() */
+    uint16_t event;         /**< SyncpointTraceEvent */
+    uint8_t  phase;         /**< SyncpointTracePhase */
+    uint8_t  mainThread;    /**< 1 if recorded on the main thread */
+    uint32_t arg;
+} SyncpointTraceRecord;
+
+/** The header at the start of a dump, followed by 'count' records in chronological order.
+    All fields are in the byte order of the device that made the dump. */
+typedef struct {
+    char     magic[4];      /**< "SPTR" */
+    uint32_t version;       /**< 1 */
+    uint32_t recordSize;    /**< sizeof(SyncpointTraceRecord) */
+    uint32_t count;         /**< Number of records that follow */
+    uint32_t timebaseNumer; /**< Multiply times by numer/denom to get nanoseconds */
+    uint32_t timebaseDenom;
+} SyncpointTraceFileHeader;
+
+
+/** Appends an event to the trace buffer. Cheap enough to call anywhere, on any thread. */
+void SyncpointTraceRecordEvent(SyncpointTraceEvent event, SyncpointTracePhase phase, uint32_t arg);
+
+#define SyncpointTrace(EVENT, ARG)      SyncpointTraceRecordEvent(EVENT, kSyncpointTraceInstant, ARG)
+#define SyncpointTraceBegin(EVENT, ARG) SyncpointTraceRecordEvent(EVENT, kSyncpointTraceBegin, ARG)
+#define SyncpointTraceEnd(EVENT, ARG)   SyncpointTraceRecordEvent(EVENT, kSyncpointTraceEnd, ARG)
+
+/** The name of an event type, e.g. "reconcile", for decoders. */
+const char* SyncpointTraceEventName(uint16_t event);
+
+
+
+@interface SyncpointTrace : NSObject
+
+/** Writes the events currently in the trace buffer to a file, oldest first. */
++ (BOOL) dumpToFile: (NSString*)path error: (NSError**)outError;
+
+/** The total number of events recorded since launch; the buffer holds only the latest
+    bufferCapacity of them. */
++ (NSUInteger) eventCount;
+
+/** The number of events the buffer holds. */
++ (NSUInteger) bufferCapacity;
+
+@end
@@ -0,0 +1,112 @@
+//
+//  SyncpointTrace.m
+//  Syncpoint
+//
+//  Created by agent on 10/16/26.
+//  Copyright (c) 2026 Couchbase, Inc. All rights reserved.
+//
+
+#import "SyncpointTrace.h"
+#import <libkern/OSAtomic.h>
+#import <mach/mach_time.h>
+#import <pthread.h>
+
+
+#define kCapacity 8192      // must be a power of 2; 128KB of records
+
+
+static SyncpointTraceRecord sBuffer[kCapacity];
+static volatile int64_t sCount;
+
+
+void SyncpointTraceRecordEvent(SyncpointTraceEvent event, SyncpointTracePhase phase, uint32_t arg) {
+    // Claim a slot atomically, then fill it in. (A dump made at the same moment could catch a
+    // record half-written; that's an acceptable price for not taking a lock.)
+    int64_t index = OSAtomicIncrement64Barrier(&sCount) - 1;
+    SyncpointTraceRecord* record = &sBuffer[index & (kCapacity - 1)];
+    record->time = mach_absolute_time();
+    record->event = (uint16_t)event;
+    record->phase = (uint8_t)phase;
+    record->mainThread = (uint8_t)pthread_main_np();
+    record->arg = arg;
+}
+
+
+const char* SyncpointTraceEventName(uint16_t event) {
+    static const char* const kNames[kSyncpointTraceNumEvents] = {
+        NULL, "state", "change_batch", "reconcile", "graph_load", "lookup", "save",
+        "replication_start", "replication_stop", "server_lost", "server_regained",
+        "burst"
+    };
+    if (event == 0 || event >= kSyncpointTraceNumEvents)
+        return "unknown";
+    return kNames[event];
+}
+
+
+@implementation SyncpointTrace
+
+
++ (NSUInteger) eventCount {
+    return (NSUInteger)sCount;
+}
+
+
++ (NSUInteger) bufferCapacity {
+    return kCapacity;
+}
+
+
++ (BOOL) dumpToFile: (NSString*)path error: (NSError**)outError {
+    // Copy the buffer first, so events recorded while writing don't shuffle it:
+    int64_t total = sCount;
+    uint32_t count = (uint32_t)MIN(total, (int64_t)kCapacity);
+    NSUInteger start = (total > kCapacity) ? (NSUInteger)(total & (kCapacity - 1)) : 0;
+
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    SyncpointTraceFileHeader header = {{'S','P','T','R'}, 1, sizeof(SyncpointTraceRecord), count,
+                                       timebase.numer, timebase.denom};
+    NSMutableData* data = [NSMutableData dataWithCapacity: sizeof(header)
+                                                           + count * sizeof(SyncpointTraceRecord)];
+    [data appendBytes: &header length: sizeof(header)];
+    NSUInteger firstPart = MIN(count, kCapacity - start);
+    [data appendBytes: &sBuffer[start] length: firstPart * sizeof(SyncpointTraceRecord)];
+    [data appendBytes: &sBuffer[0] length: (count - firstPart) * sizeof(SyncpointTraceRecord)];
+    return [data writeToFile: path options: NSDataWritingAtomic error: outError];
+}
+
+
+@end
+
+
+
+
+#pragma mark - TESTS:
+#if DEBUG
+
+TestCase(SyncpointTrace) {
+    NSUInteger before = [SyncpointTrace eventCount];
+    for (uint32_t i = 0; i < kCapacity + 10; ++i)
+        SyncpointTrace(kSyncpointTraceModelLookup, i);
+    CAssertEq([SyncpointTrace eventCount], before + kCapacity + 10);
+
+    NSString* path = [NSTemporaryDirectory() stringByAppendingPathComponent: @"SyncpointTrace.sptrace"];
+    NSError* error;
+    CAssert([SyncpointTrace dumpToFile: path error: &error], @"Dump failed: %@", error);
+    NSData* data = [NSData dataWithContentsOfFile: path];
+    [[NSFileManager defaultManager] removeItemAtPath: path error: NULL];
+    const SyncpointTraceFileHeader* header = data.bytes;
+    CAssertEq(memcmp(header->magic, "SPTR", 4), 0);
+    CAssertEq(header->count, (uint32_t)kCapacity);
+    CAssertEq(data.length, sizeof(*header) + kCapacity * sizeof(SyncpointTraceRecord));
+
+    // The oldest events were overwritten; the rest come out in order:
+    const SyncpointTraceRecord* records = (const void*)(header + 1);
+    CAssertEq(records[0].arg, 10u);
+    CAssertEq(records[kCapacity - 1].arg, (uint32_t)kCapacity + 9);
+    for (NSUInteger i = 1; i < kCapacity; ++i)
+        CAssert(records[i].time >= records[i-1].time);
+}
+
+#endif